@@ -0,0 +1,81 @@
+//
+// Edge trace capture for offline replay.
+//
+// Dump format, one record per line:
+//   S <timerClockHz> <adcOffset> <resFullScaleOhms> <MEASURE_MEDIAN_WINDOW> <MEASURE_MAX_FREQ_HZ>
+//   M <armed> <filled> <next> <minCounts> <window[0]> ... <window[MEASURE_MEDIAN_WINDOW - 1]>
+//                                        Measure state before the first edge
+//   R                                    Measure_Reset() before the next edge
+//   E <line> <counts> <adc>              one edge, in order
+//
+#include "diag/Trace.h"
+#include "capture.h"
+
+#ifdef CAPTURE_EDGES
+
+static CaptureRecord captureRing[CAPTURE_DEPTH];
+static Measure captureStart; // Measure state the first captured edge was fed into
+static volatile uint32_t captureCount = 0;
+
+
+//
+// Called from the EXTI handlers just before Measure_Edge(), after any
+// Measure_Reset(). Edges arriving while the ring is full are dropped, so
+// every dump is one gap-free run of edges.
+//
+void Capture_Edge(uint8_t line, uint32_t counts, uint16_t adc, uint8_t reset, const Measure *measure)
+{
+	uint32_t index = captureCount;
+
+	if (index < CAPTURE_DEPTH)
+	{
+		if (index == 0)
+		{
+			// The snapshot already includes any reset, so it is not flagged again
+			captureStart = *measure;
+			reset = 0;
+		}
+		captureRing[index].counts = counts;
+		captureRing[index].adc = adc;
+		captureRing[index].line = line;
+		captureRing[index].flags = reset ? CAPTURE_FLAG_RESET : 0;
+		captureCount = index + 1;
+	}
+}
+
+
+int Capture_Full(void)
+{
+	return captureCount >= CAPTURE_DEPTH;
+}
+
+
+//
+// Prints the captured edges and restarts the capture. Called from the main
+// loop, never from an interrupt.
+//
+void Capture_Dump(const Settings *settings)
+{
+	trace_printf("S %u %d %u %u %u\n", (unsigned int)settings->timerClockHz,
+		(int)settings->adcOffset, (unsigned int)settings->resFullScaleOhms,
+		(unsigned int)MEASURE_MEDIAN_WINDOW, (unsigned int)MEASURE_MAX_FREQ_HZ);
+	trace_printf("M %u %u %u %u", (unsigned int)captureStart.armed, (unsigned int)captureStart.filled,
+		(unsigned int)captureStart.next, (unsigned int)captureStart.minCounts);
+	for (int i = 0; i < MEASURE_MEDIAN_WINDOW; i++)
+	{
+		trace_printf(" %u", (unsigned int)captureStart.window[i]);
+	}
+	trace_printf("\n");
+	for (uint32_t i = 0; i < captureCount; i++)
+	{
+		if (captureRing[i].flags & CAPTURE_FLAG_RESET)
+		{
+			trace_printf("R\n");
+		}
+		trace_printf("E %u %u %u\n", (unsigned int)captureRing[i].line,
+			(unsigned int)captureRing[i].counts, (unsigned int)captureRing[i].adc);
+	}
+	captureCount = 0;
+}
+
+#endif // CAPTURE_EDGES
@@ -0,0 +1,46 @@
+//
+// Edge trace capture for offline replay.
+//
+// Build with CAPTURE_EDGES defined to record the TIM2 count and the ADC
+// reading seen by every EXTI1/EXTI2 edge into a RAM ring. Once the ring is
+// full, the main loop dumps it on the trace device in the text format read
+// by tools/replay.c, then starts a new capture. Without CAPTURE_EDGES the
+// hooks compile to nothing.
+//
+// A capture can start at any point of the edge pairing, so the first edge
+// also snapshots the Measure state it was fed into. Together with the
+// glitch settings and the mode-switch resets this lets the replay pair
+// and filter every edge exactly as the board did.
+//
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include <stdint.h>
+#include "settings.h"
+#include "measure.h"
+
+/* Number of edges per capture, 8 bytes each */
+#define CAPTURE_DEPTH 256
+
+/* CaptureRecord flags */
+#define CAPTURE_FLAG_RESET 0x01 // Measure_Reset() ran just before this edge (mode switch)
+
+typedef struct
+{
+	uint32_t counts; // TIM2->CNT at the edge
+	uint16_t adc;    // ADC1->DR at the edge
+	uint8_t line;    // EXTI line that fired (1 = 555 timer, 2 = function generator)
+	uint8_t flags;   // CAPTURE_FLAG_*
+} CaptureRecord;
+
+#ifdef CAPTURE_EDGES
+void Capture_Edge(uint8_t line, uint32_t counts, uint16_t adc, uint8_t reset, const Measure *measure);
+int Capture_Full(void);
+void Capture_Dump(const Settings *settings);
+#else
+#define Capture_Edge(line, counts, adc, reset, measure) ((void)0)
+#define Capture_Full() (0)
+#define Capture_Dump(settings) ((void)0)
+#endif
+
+#endif // CAPTURE_H_
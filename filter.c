@@ -0,0 +1,183 @@
+//
+// Fixed-point filter stage for the ADC to DAC signal path.
+//
+// The Cortex-M0 has a single cycle 32 bit multiply but no 64 bit MAC, so
+// both filters keep their accumulators in 32 bits: 12 bit samples times
+// Q14/Q15 coefficients leave enough headroom for the taps used here.
+//
+#include "filter.h"
+
+/* Shared by every preset that skips the FIR */
+#define FILTER_FIR_BYPASS 1, 1, { 32767 }
+/* Shared by every preset that skips the biquad */
+#define FILTER_BIQUAD_BYPASS { 16384, 0, 0, 0, 0 }
+
+//
+// Presets for an 8 kHz input rate, generated by tools/filter_design.c.
+// Rerun it and paste its output here when changing the rate or a cutoff.
+//
+const FilterPreset Filter_Presets[] =
+{
+	// filter_design "Passthrough" 8000 1 1 0 0
+	{ "Passthrough", FILTER_FIR_BYPASS, FILTER_BIQUAD_BYPASS },
+	// filter_design "Lowpass 100 Hz" 8000 1 1 0 100
+	{ "Lowpass 100 Hz", FILTER_FIR_BYPASS,
+		{ 24, 48, 24, -30950, 14662 } },
+	// filter_design "Decimate 4, lowpass 200 Hz" 8000 4 16 800 200
+	{ "Decimate 4, lowpass 200 Hz", 16, 4,
+		{
+			-114, -159, -139, 291, 1450, 3284, 5246, 6525,
+			6525, 5246, 3284, 1450, 291, -139, -159, -114 },
+		{ 1105, 2210, 1105, -18727, 6763 } },
+};
+const unsigned int Filter_PresetCount = sizeof(Filter_Presets) / sizeof(Filter_Presets[0]);
+
+
+static int16_t filter_saturate(int32_t value)
+{
+	if (value > INT16_MAX)
+	{
+		return INT16_MAX;
+	}
+	if (value < INT16_MIN)
+	{
+		return INT16_MIN;
+	}
+	return (int16_t)value;
+}
+
+
+//
+// initial is the input level the filter should start settled at, so the
+// output does not ramp up from zero at boot.
+//
+void Biquad_Init(Biquad *biquad, const BiquadCoeffs *coeffs, int16_t initial)
+{
+	biquad->coeffs = coeffs;
+	biquad->x1 = biquad->x2 = initial;
+	biquad->y1 = biquad->y2 = initial;
+	biquad->error = 0;
+}
+
+
+//
+// Direct form I. The bits dropped when scaling each output back from Q14
+// are added to the next accumulator (first order error feedback), which
+// removes the DC offset and limit cycles of plain truncation at low
+// cutoffs. in and out may be the same buffer.
+//
+void Biquad_ProcessBlock(Biquad *biquad, const int16_t *in, int16_t *out, unsigned int n)
+{
+	const int32_t b0 = biquad->coeffs->b0, b1 = biquad->coeffs->b1, b2 = biquad->coeffs->b2;
+	const int32_t a1 = biquad->coeffs->a1, a2 = biquad->coeffs->a2;
+	int32_t x1 = biquad->x1, x2 = biquad->x2;
+	int32_t y1 = biquad->y1, y2 = biquad->y2;
+	int32_t error = biquad->error;
+
+	for (unsigned int i = 0; i < n; i++)
+	{
+		int32_t x0 = in[i];
+		int32_t acc = b0 * x0 + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2 + error;
+		int32_t y0 = filter_saturate(acc >> 14);
+
+		error = acc - y0 * 16384;
+		x2 = x1;
+		x1 = x0;
+		y2 = y1;
+		y1 = y0;
+		out[i] = (int16_t)y0;
+	}
+
+	biquad->x1 = (int16_t)x1;
+	biquad->x2 = (int16_t)x2;
+	biquad->y1 = (int16_t)y1;
+	biquad->y2 = (int16_t)y2;
+	biquad->error = error;
+}
+
+
+void FirDecim_Init(FirDecimator *fir, const int16_t *taps, uint8_t numTaps, uint8_t decimation, int16_t initial)
+{
+	fir->taps = taps;
+	fir->numTaps = (numTaps > FILTER_MAX_TAPS) ? FILTER_MAX_TAPS : numTaps;
+	fir->decimation = (decimation == 0) ? 1 : decimation;
+	fir->phase = 0;
+	fir->head = 0;
+	for (unsigned int i = 0; i < 2 * FILTER_MAX_TAPS; i++)
+	{
+		fir->history[i] = initial;
+	}
+}
+
+
+//
+// Pushes n inputs and computes the FIR only for the samples that are
+// kept, so decimating by M costs 1/M of the multiplies. Each sample is
+// stored twice, numTaps apart, so the taps always read one contiguous
+// window. Returns the number of outputs written. out may alias in.
+//
+unsigned int FirDecim_ProcessBlock(FirDecimator *fir, const int16_t *in, int16_t *out, unsigned int n)
+{
+	const unsigned int numTaps = fir->numTaps;
+	unsigned int head = fir->head;
+	unsigned int phase = fir->phase;
+	unsigned int produced = 0;
+
+	for (unsigned int i = 0; i < n; i++)
+	{
+		fir->history[head] = in[i];
+		fir->history[head + numTaps] = in[i];
+		head = (head + 1 == numTaps) ? 0 : head + 1;
+
+		if (++phase < fir->decimation)
+		{
+			continue;
+		}
+		phase = 0;
+
+		// history[head + numTaps - 1] is the newest sample, it meets taps[0]
+		const int16_t *sample = &fir->history[head + numTaps - 1];
+		int32_t acc = 1 << 14; // Rounds the Q15 result
+		for (unsigned int k = 0; k < numTaps; k++)
+		{
+			acc += (int32_t)fir->taps[k] * *sample--;
+		}
+		out[produced++] = filter_saturate(acc >> 15);
+	}
+
+	fir->head = (uint8_t)head;
+	fir->phase = (uint8_t)phase;
+	return produced;
+}
+
+
+void Filter_Init(FilterStage *stage, const FilterPreset *preset, int16_t initial)
+{
+	FirDecim_Init(&stage->fir, preset->taps, preset->numTaps, preset->decimation, initial);
+	Biquad_Init(&stage->biquad, &preset->biquad, initial);
+}
+
+
+//
+// Runs n input samples through the FIR then the biquad and clamps the
+// result to the DAC range. Returns the number of outputs, n / decimation
+// when n is a multiple of the decimation.
+//
+unsigned int Filter_ProcessBlock(FilterStage *stage, const int16_t *in, int16_t *out, unsigned int n)
+{
+	unsigned int produced = FirDecim_ProcessBlock(&stage->fir, in, out, n);
+
+	Biquad_ProcessBlock(&stage->biquad, out, out, produced);
+	for (unsigned int i = 0; i < produced; i++)
+	{
+		if (out[i] < 0)
+		{
+			out[i] = 0;
+		}
+		else if (out[i] > FILTER_OUTPUT_MAX)
+		{
+			out[i] = FILTER_OUTPUT_MAX;
+		}
+	}
+	return produced;
+}
@@ -0,0 +1,67 @@
+//
+// Fixed-point filter stage for the ADC to DAC signal path.
+//
+// A decimating FIR (Q15 taps) followed by a biquad IIR (Q14 coefficients)
+// running on blocks of 12 bit samples. Plain C with no register access, so
+// tools/filter_design.c runs the same code on the host.
+//
+#ifndef FILTER_H_
+#define FILTER_H_
+
+#include <stdint.h>
+
+/* Longest supported FIR */
+#define FILTER_MAX_TAPS 32
+
+/* Output range of the stage, the 12 bit DAC */
+#define FILTER_OUTPUT_MAX 4095
+
+typedef struct
+{
+	// y[n] = b0 x[n] + b1 x[n-1] + b2 x[n-2] - a1 y[n-1] - a2 y[n-2], all Q14
+	int16_t b0, b1, b2, a1, a2;
+} BiquadCoeffs;
+
+typedef struct
+{
+	const char *name;
+	uint8_t numTaps;       // FIR length, at most FILTER_MAX_TAPS
+	uint8_t decimation;    // FIR keeps one output every decimation inputs
+	int16_t taps[FILTER_MAX_TAPS]; // FIR taps, Q15
+	BiquadCoeffs biquad;   // Designed for the decimated rate
+} FilterPreset;
+
+typedef struct
+{
+	const BiquadCoeffs *coeffs;
+	int16_t x1, x2, y1, y2;
+	int32_t error;         // Rounding error fed back into the next output
+} Biquad;
+
+typedef struct
+{
+	const int16_t *taps;
+	uint8_t numTaps;
+	uint8_t decimation;
+	uint8_t phase;         // Inputs since the last output
+	uint8_t head;
+	int16_t history[2 * FILTER_MAX_TAPS]; // Doubled so the taps never wrap
+} FirDecimator;
+
+typedef struct
+{
+	FirDecimator fir;
+	Biquad biquad;
+} FilterStage;
+
+extern const FilterPreset Filter_Presets[];
+extern const unsigned int Filter_PresetCount;
+
+void Biquad_Init(Biquad *biquad, const BiquadCoeffs *coeffs, int16_t initial);
+void Biquad_ProcessBlock(Biquad *biquad, const int16_t *in, int16_t *out, unsigned int n);
+void FirDecim_Init(FirDecimator *fir, const int16_t *taps, uint8_t numTaps, uint8_t decimation, int16_t initial);
+unsigned int FirDecim_ProcessBlock(FirDecimator *fir, const int16_t *in, int16_t *out, unsigned int n);
+void Filter_Init(FilterStage *stage, const FilterPreset *preset, int16_t initial);
+unsigned int Filter_ProcessBlock(FilterStage *stage, const int16_t *in, int16_t *out, unsigned int n);
+
+#endif // FILTER_H_
@@ -7,6 +7,11 @@
 #include "diag/Trace.h"
 #include <string.h>
 #include "cmsis/cmsis_device.h"
+#include "settings.h"
+#include "measure.h"
+#include "capture.h"
+#include "filter.h"
+#include "oled.h"
 // ----------------------------------------------------------------------------
 //
 // STM32F0 led blink sample (trace via $(trace)).
@@ -50,18 +55,47 @@
 #define myTIM2_PRESCALER ((uint16_t)0x0000)
 /* Maximum possible setting for overflow */
 #define myTIM2_PERIOD ((uint32_t)0xFFFFFFFF)
+/* TIM3 paces the ADC -> filter -> DAC path at a fixed rate */
+#define FILTER_SAMPLE_RATE_HZ ((uint32_t)8000)
+/* Input samples per block, a multiple of every preset's decimation (checked in main()) */
+#define FILTER_BLOCK_SIZE 32
+/* A new mode is saved once it has been left alone this long, counted in TIM3 blocks (3 s) */
+#define SETTINGS_SAVE_DELAY_BLOCKS (3 * FILTER_SAMPLE_RATE_HZ / FILTER_BLOCK_SIZE)
+/* Calibration, entered by holding USER through reset (see calibrate()) */
+#define CALIBRATION_REFERENCE_HZ ((uint32_t)1000) // Function generator frequency on PA2
+#define CALIBRATION_PERIODS ((uint32_t)1000)      // Reference periods timed for the trim
+#define CALIBRATION_POT_OHMS ((uint32_t)5000)     // Potentiometer resistance at its maximum
+#define CALIBRATION_ADC_SAMPLES 256
+#define CALIBRATION_MIN_SPAN ((uint32_t)1024)     // Smallest accepted ADC span between 0 Ohms and maximum
+#define CALIBRATION_CLOCK_TOLERANCE_PCT ((uint32_t)3) // Accepted trim around the nominal clock, HSI is +-1%
+_Static_assert(CALIBRATION_POT_OHMS * SETTINGS_ADC_FULL_SCALE / CALIBRATION_MIN_SPAN <= 0xFFFF,
+	"resFullScaleOhms is 16 bits");
+_Static_assert(SETTINGS_DEFAULT_TIMER_CLOCK_HZ / 100 * (100 + CALIBRATION_CLOCK_TOLERANCE_PCT)
+	/ FILTER_SAMPLE_RATE_HZ - 1 <= 0xFFFF, "TIM3->ARR is 16 bits");
+/* Index into Filter_Presets[], the presets are designed for 8 kHz */
+#ifndef FILTER_PRESET
+#define FILTER_PRESET 1
+#endif
 /*** This is partial code for accessing LED Display via SPI interface. ***/
 //...
 volatile unsigned int Freq = 0;  // Example: measured frequency value (global variable)
 volatile unsigned int Res = 0;   // Example: measured resistance value (global variable)
 volatile int globalSignal = 1; // Toggles the states
-volatile uint8_t timerTriggered = 0;
-void oled_Write(unsigned char);
-void oled_Write_Cmd(unsigned char);
-void oled_Write_Data(unsigned char);
+volatile uint8_t settingsDirty = 0; // Set when the mode changes, saved from the main loop once stable
+volatile uint8_t measureReset = 0; // Set when the mode changes, the next edge resets the measurement
+Settings settings; // Calibration and last mode, loaded from flash at boot
+uint8_t adcCalFactor = 0; // Result of the ADC self-calibration, for the debugger
+SettingsStore settingsStore; // Where settings live in flash
+Measure measure; // Edge pairing and statistics shared by EXTI1 and EXTI2
+FilterStage filterStage; // FIR and biquad state between ADC and DAC
+int16_t filterIn[2][FILTER_BLOCK_SIZE];  // ADC samples, one half filled by TIM3_IRQHandler
+int16_t filterOut[2][FILTER_BLOCK_SIZE]; // Filtered samples, one half played by TIM3_IRQHandler
+volatile uint8_t filterHalf = 0;  // Half TIM3_IRQHandler is filling and playing
+volatile uint8_t filterReady = 0; // Set when the other half holds a full input block
+volatile uint32_t filterOverruns = 0; // Blocks the main loop had not filtered when TIM3 switched halves
 void oled_config(void);
 void refresh_OLED(void);
-SPI_HandleTypeDef SPI_Handle;
+void refresh_OLED_Line(unsigned char, const unsigned char *);
 //
 // LED Display initialization commands
 //
@@ -267,6 +301,13 @@ void ADC_initialize()
 	//Set Port A pin 5 to analog mode
 	GPIOA->MODER |= (3 << (2 * 5)); //SET PA5(ADC_IN5) as an analog mode pin
 
+	//Step 0, self-calibration, must run while the ADC is disabled (ADEN = 0)
+	//The F0 has no register to load a saved factor back, and ADCAL only takes
+	//about 83 ADC clocks, so it runs on every boot instead of being stored
+	ADC1->CR |= ADC_CR_ADCAL;
+	while(ADC1->CR & ADC_CR_ADCAL); //Hardware clears ADCAL when done
+	adcCalFactor = ADC1->DR & 0x7F; //Calibration factor is left in DR[6:0]
+
 	//Step 1, ADC->CFGR1 (page 10 of example PDF)
 	ADC1->CFGR1 &= ~(0b11000); //Clears Bits[4:3] which creates 12 bit resolution
 	ADC1->CFGR1 &= ~(0b100000); //Clears Bit[5] which creates right alignment data
@@ -344,32 +385,38 @@ void myTIM2_Init()
 
 void myTIM3_Init()
 {
-	/* Enable clock for TIM2 peripheral */
+	/* Enable clock for TIM3 peripheral */
 	// Relevant register: RCC->APB1ENR
 	RCC->APB1ENR |= RCC_APB1ENR_TIM3EN;
-	/* Configure TIM2: buffer auto-reload, count up, stop on overflow,
+
+	/* Configure TIM3: buffer auto-reload, count up, keep running on overflow,
 	 * enable update events, interrupt on overflow only */
-	// Relevant register: TIM2->CR1
-	TIM3->CR1 = ((uint16_t)0x008C);
-	/* Set clock prescaler value */
-	//TIM2->PSC = myTIM2_PRESCALER;
+	// Relevant register: TIM3->CR1
+	TIM3->CR1 = ((uint16_t)0x0084);
+
+	/* Set clock prescaler value: no prescaling, as for TIM2 */
 	TIM3->PSC = ((uint16_t)0x0000);
-	/* Set auto-reloaded delay */
-	TIM3->ARR = myTIM2_PERIOD;
-	//TIM2->ARR = ((uint32_t)12000000);
+
+	/* Overflow once per filter sample, from the trimmed timer clock */
+	TIM3->ARR = settings.timerClockHz / FILTER_SAMPLE_RATE_HZ - 1;
+
 	/* Update timer registers */
-	// Relevant register: TIM2->EGR
-	//TIM2->EGR = ((uint16_t)0x001);
+	// Relevant register: TIM3->EGR
 	TIM3->EGR = ((uint16_t)0x0001);
-	/* Assign TIM2 interrupt priority = 0 in NVIC */
-	// Relevant register: NVIC->IP[3], or use NVIC_SetPriority
-	NVIC_SetPriority(TIM3_IRQn, 4);
-	/* Enable TIM2 interrupts in NVIC */
+
+	/* Assign TIM3 interrupt priority = 3 in NVIC */
+	// Relevant register: NVIC->IP[4], or use NVIC_SetPriority
+	// Lowest of the 4 levels on the M0, so the EXTI edge timing always wins
+	NVIC_SetPriority(TIM3_IRQn, 3);
+
+	/* Enable TIM3 interrupts in NVIC */
 	// Relevant register: NVIC->ISER[0], or use NVIC_EnableIRQ
-	//NVIC_EnableIRQ(TIM2_IRQn);
+	NVIC_EnableIRQ(TIM3_IRQn);
+
 	/* Enable update interrupt generation */
-	// Relevant register: TIM2->DIER
+	// Relevant register: TIM3->DIER
 	TIM3->DIER |= TIM_DIER_UIE;
+
 	/* Start Counting Timer Pulses*/
 	TIM3-> CR1 |= TIM_CR1_CEN;
 }
@@ -406,8 +453,10 @@ void myEXTI2_3_Init()
 	EXTI->IMR |= EXTI_IMR_MR2;
 
 	/* Assign EXTI2 interrupt priority = 0 in NVIC */
-	// Relevant register: NVIC->IP[2], or use NVIC_SetPriority
-	NVIC_SetPriority(EXTI2_3_IRQn, 1);
+	// Relevant register: NVIC->IP[1], or use NVIC_SetPriority
+	// Same level as EXTI0_1 (USER and the 555 on EXTI1), so neither edge
+	// handler can preempt the other halfway through Measure_Edge()
+	NVIC_SetPriority(EXTI2_3_IRQn, 0);
 
 	/* Enable EXTI2 interrupts in NVIC */
 	// Relevant register: NVIC->ISER[0], or use NVIC_EnableIRQ
@@ -417,52 +466,88 @@ void myEXTI2_3_Init()
 
 void EXTI2_3_IRQHandler()
 {
-	// Declare/initialize your local variables here...
-	double float_frequency;
-	double float_scaledPeriod;
-	unsigned int frequency;
-	unsigned int scaledPeriod;
-
 	/* Check if EXTI2 interrupt pending flag is indeed set */
 	if ((EXTI->PR & EXTI_PR_PR2) != 0)
 	{
+		// Read the count while TIM2 is still running, the measurement
+		// library decides whether this edge starts or ends a period
+		uint32_t counts = TIM2->CNT;
+		uint16_t adc = ADC1->DR;
+		uint8_t reset = measureReset;
+		if(reset)
+		{
+			measureReset = 0;
+			Measure_Reset(&measure);
+		}
+		Capture_Edge(2, counts, adc, reset, &measure);
+		int result = Measure_Edge(&measure, counts, adc, &settings);
+		if(result == MEASURE_ARMED)
+		{
+			// First edge: clear and start the timer
+			TIM2->CNT = 0;
+			TIM2->CR1 |= TIM_CR1_CEN;
+		}
+		else if(result == MEASURE_PUBLISHED)
+		{
+			// Second edge: stop the timer and publish the frequency
+			TIM2->CR1 &= ~(TIM_CR1_CEN);
+			Freq = measure.freq;
+			Res = 0;
+		}
+		else if(result == MEASURE_FILLING)
+		{
+			// Second edge while the median window refills: stop the timer, nothing to show yet
+			TIM2->CR1 &= ~(TIM_CR1_CEN);
+		}
+		// MEASURE_REJECTED: a glitch, TIM2 keeps running for the real edge
 		//
-		// 1. If this is the first edge:
-		//	- Clear count register (TIM2->CNT).
-		//	- Start timer (TIM2->CR1).
-    if(!timerTriggered)
-    {
-        TIM2->CNT = 0;
-        TIM2->CR1 |= TIM_CR1_CEN;
-        timerTriggered = 1;
-    }
-		//    Else (this is the second edge):
-		//	- Stop timer (TIM2->CR1).
-		//	- Read out count register (TIM2->CNT).
-		//	- Calculate signal period and frequency.
-		//	- Print calculated values to the console.
-		//	  NOTE: Function trace_printf does not work
-		//	  with floating-point numbers: you must use
-		//	  "unsigned int" type to print your signal
-		//	  period and frequency.
-    else
-    {
-        TIM2->CR1 &= ~(TIM_CR1_CEN);
-        uint32_t timerValue = TIM2->CNT;
-        float_frequency = 48000000 / timerValue;
-        float_scaledPeriod = 1/float_frequency;
-        frequency = float_frequency;
-        Freq = float_frequency;
-
-        Res = 0;
-        timerTriggered = 0;
-    }
-		//
-		// 2. Clear EXTI2 interrupt pending flag (EXTI->PR).
+		// Clear EXTI2 interrupt pending flag (EXTI->PR).
 		// NOTE: A pending register (PR) bit is cleared
 		// by writing 1 to it.
 		//
-    EXTI->PR |= EXTI_PR_PR2;
+		EXTI->PR |= EXTI_PR_PR2;
+	}
+}
+
+
+void TIM3_IRQHandler()
+{
+	static uint16_t index = 0; // Input sample within the current half
+	static uint16_t output = 0; // Output sample within the current half
+	static uint8_t phase = 0;  // Input samples since output last advanced
+
+	/* Check if update interrupt flag is indeed set */
+	if ((TIM3->SR & TIM_SR_UIF) != 0)
+	{
+		uint8_t half = filterHalf;
+
+		// Sample the ADC and play the block filtered one block earlier.
+		// A decimated output is held for decimation samples.
+		filterIn[half][index] = ADC1->DR;
+		DAC->DHR12R1 = filterOut[half][output];
+		if(++phase == filterStage.fir.decimation)
+		{
+			phase = 0;
+			output++;
+		}
+		if(++index == FILTER_BLOCK_SIZE)
+		{
+			index = 0;
+			output = 0;
+			phase = 0;
+			if(filterReady)
+			{
+				// The main loop has not filtered the last block yet: the half
+				// about to be played and refilled was never processed
+				filterOverruns++;
+			}
+			filterHalf = half ^ 1;
+			filterReady = 1;
+		}
+
+		/* Clear update interrupt flag */
+		// Relevant register: TIM3->SR
+		TIM3->SR &= ~(TIM_SR_UIF);
 	}
 }
 
@@ -489,29 +574,225 @@ void myGPIOA_Init()
 }
 
 
+//
+// Calibration helpers, only used by calibrate() before the interrupts are on
+//
+void calibration_wait_button( void )
+{
+	while(!(GPIOA->IDR & GPIO_IDR_0)); //Wait for USER (PA0) to be pressed
+	for(int x = 0; x < 100000; x++); //Debounce
+	while(GPIOA->IDR & GPIO_IDR_0); //Wait for release
+	for(int x = 0; x < 100000; x++);
+}
+
+
+unsigned int calibration_read_adc( void )
+{
+	uint32_t sum = 0;
+	for(unsigned int i = 0; i < CALIBRATION_ADC_SAMPLES; i++)
+	{
+		while(!(ADC1->ISR & ADC_ISR_EOC)); //Reading DR clears EOC, so each sample is new
+		sum += ADC1->DR;
+	}
+	return sum / CALIBRATION_ADC_SAMPLES;
+}
+
+
+//
+// Waits for a rising edge on PA2 and stores TIM2->CNT at that edge in
+// counts. Returns 0 if none came within about a second of timer clock.
+//
+int calibration_rising_edge( uint32_t *counts )
+{
+	uint32_t start = TIM2->CNT;
+	while(GPIOA->IDR & GPIO_IDR_2) //Wait for low
+	{
+		if(TIM2->CNT - start > settings.timerClockHz) return 0;
+	}
+	while(!(GPIOA->IDR & GPIO_IDR_2)) //Then for the rising edge
+	{
+		if(TIM2->CNT - start > settings.timerClockHz) return 0;
+	}
+	*counts = TIM2->CNT;
+	return 1;
+}
+
+
+//
+// Measures and saves the three calibration values, guided on the trace
+// device. Each step is confirmed with the USER button:
+//   1. potentiometer at 0 Ohms      -> adcOffset
+//   2. potentiometer at maximum     -> resFullScaleOhms
+//   3. CALIBRATION_REFERENCE_HZ on PA2 -> timerClockHz
+//
+void calibrate( void )
+{
+	trace_printf("Calibration: release USER\n");
+	while(GPIOA->IDR & GPIO_IDR_0);
+	for(int x = 0; x < 100000; x++);
+
+	trace_printf("Set the potentiometer to 0 Ohms and press USER\n");
+	calibration_wait_button();
+	unsigned int zero = calibration_read_adc();
+	settings.adcOffset = zero;
+
+	trace_printf("Set the potentiometer to its maximum and press USER\n");
+	calibration_wait_button();
+	unsigned int top = calibration_read_adc();
+	if(top >= zero + CALIBRATION_MIN_SPAN)
+	{
+		//Resistance that would read as ADC full scale once the offset is removed
+		settings.resFullScaleOhms = (CALIBRATION_POT_OHMS * SETTINGS_ADC_FULL_SCALE) / (top - zero);
+	}
+	else
+	{
+		//A small span would overflow the 16 bit full scale, or is just noise
+		trace_printf("ADC span %d too small, full scale left unchanged\n", (int)top - (int)zero);
+	}
+
+	trace_printf("Feed %u Hz to PA2 and press USER\n", (unsigned int)CALIBRATION_REFERENCE_HZ);
+	calibration_wait_button();
+	TIM2->CNT = 0;
+	TIM2->CR1 |= TIM_CR1_CEN; //TIM2 stops on overflow, restart it from zero
+	uint32_t first = 0;
+	uint32_t last = 0;
+	int ok = calibration_rising_edge(&first);
+	for(uint32_t i = 0; i < CALIBRATION_PERIODS && ok; i++)
+	{
+		ok = calibration_rising_edge(&last);
+	}
+	if(ok)
+	{
+		//Timer clock = counts per reference period * reference frequency
+		uint32_t clockHz = ((uint64_t)(last - first) * CALIBRATION_REFERENCE_HZ) / CALIBRATION_PERIODS;
+		uint32_t tolerance = SETTINGS_DEFAULT_TIMER_CLOCK_HZ / 100 * CALIBRATION_CLOCK_TOLERANCE_PCT;
+		//A wrong reference or a missed edge must not scale every reading and TIM3->ARR for good
+		if(clockHz >= SETTINGS_DEFAULT_TIMER_CLOCK_HZ - tolerance
+			&& clockHz <= SETTINGS_DEFAULT_TIMER_CLOCK_HZ + tolerance)
+		{
+			settings.timerClockHz = clockHz;
+		}
+		else
+		{
+			trace_printf("Measured %u Hz, not within %u%% of %u Hz, timer clock left unchanged\n",
+				(unsigned int)clockHz, (unsigned int)CALIBRATION_CLOCK_TOLERANCE_PCT,
+				(unsigned int)SETTINGS_DEFAULT_TIMER_CLOCK_HZ);
+		}
+	}
+	else
+	{
+		trace_printf("No reference on PA2, timer clock left unchanged\n");
+	}
+
+	trace_printf("Offset %d, full scale %u Ohms, timer %u Hz\n", settings.adcOffset,
+		settings.resFullScaleOhms, (unsigned int)settings.timerClockHz);
+	Settings_Save(&settingsStore, &settings);
+}
+
+
 int main(int argc, char* argv[])
 {
 	SystemClock48MHz();
+	Settings_Init(&settingsStore, &Settings_Flash);
+	Settings_Load(&settingsStore, &settings); //Falls back to the defaults if flash holds no valid record
+	Measure_Init(&measure, &settings);
 	RCC->AHBENR |= (1 << 0); // Enable clock for GPIOA
 	myGPIOA_Init();
 	ADC_initialize();
 	DAC_initialize();
 	myTIM2_Init();
+
+	//ADC runs in continuous mode, so ADC1->DR always holds a fresh sample
+	ADC1->CR |= ADC_CR_ADSTART;
+	while(!(ADC1->ISR & ADC_ISR_EOC)); // Wait for the first conversion
+	if(GPIOA->IDR & GPIO_IDR_0)
+	{
+		calibrate(); //USER held through reset, before the timer interrupts use the settings
+		Measure_Init(&measure, &settings);
+	}
+	int16_t initial = ADC1->DR;
+	if(FILTER_PRESET >= Filter_PresetCount)
+	{
+		trace_printf("FILTER_PRESET %u does not exist\n", (unsigned int)FILTER_PRESET);
+		while(1);
+	}
+	Filter_Init(&filterStage, &Filter_Presets[FILTER_PRESET], initial);
+	if(FILTER_BLOCK_SIZE % filterStage.fir.decimation != 0)
+	{
+		//TIM3_IRQHandler moves to the next filterOut sample every decimation inputs,
+		//so a block that is not a whole number of outputs would play samples the
+		//filter never wrote, and the FIR phase would drift against the blocks
+		trace_printf("%s: decimation %u does not divide FILTER_BLOCK_SIZE %u\n",
+			Filter_Presets[FILTER_PRESET].name, (unsigned int)filterStage.fir.decimation,
+			(unsigned int)FILTER_BLOCK_SIZE);
+		while(1);
+	}
+	for(unsigned int i = 0; i < FILTER_BLOCK_SIZE; i++)
+	{
+		filterOut[0][i] = filterOut[1][i] = initial; //Play the current level until the first block is out
+	}
 	myTIM3_Init();
 	oled_config();
 	EXTI0_1_Init();
 	myEXTI2_3_Init();
 
+	//Restore the last mode, EXTI0_1_Init() leaves the function generator (EXTI2) enabled
+	if(settings.mode == 0)
+	{
+		globalSignal = 0;
+		EXTI->IMR &= ~EXTI_IMR_MR2; //Disable interrupt for EXTI2
+		EXTI->IMR |= EXTI_IMR_MR1;  //Enable interrupt for EXTI1
+	}
 
+
+	uint32_t overrunsReported = 0;
+	uint32_t saveDelay = 0; // TIM3 blocks left before the new mode is saved, 0 when none is pending
 	while (1)
 	{
-		ADC1->CR |= ADC_CR_ADSTART; //Sets bit 2, starts ADC conversion process
-		while(!(ADC1-> ISR & ADC_ISR_EOS_Msk)); // Wait for conversion to finish
-		unsigned int val = ADC1->DR; //Val is between 0 and 4095
-		//trace_printf("ADC Value: %d\n", val);
+		if(settingsDirty)
+		{
+			//Every press restarts the wait, so only a mode that was left alone is saved
+			settingsDirty = 0;
+			saveDelay = SETTINGS_SAVE_DELAY_BLOCKS;
+		}
+		if(filterReady)
+		{
+			//Filter the block TIM3_IRQHandler just finished, it must be done
+			//before the handler comes back to this half (one block period)
+			uint8_t half = filterHalf ^ 1;
+			filterReady = 0;
+			Filter_ProcessBlock(&filterStage, filterIn[half], filterOut[half], FILTER_BLOCK_SIZE);
+
+			if(saveDelay && --saveDelay == 0)
+			{
+				//The F0 fetches code from the flash it is writing, so a program
+				//(about 0.4 ms) or a page erase (20-40 ms) stalls every interrupt
+				//handler too. TIM3 misses samples (a page swap shows up in
+				//filterOverruns), and an edge handler would read TIM2 only after
+				//the stall. So the edge interrupts are held off, the edges that
+				//came in meanwhile are thrown away and the open pair is dropped.
+				//Saving well after the mode switch keeps this gap away from the
+				//median window that the switch has just emptied.
+				NVIC_DisableIRQ(EXTI0_1_IRQn);
+				NVIC_DisableIRQ(EXTI2_3_IRQn);
+				settings.mode = globalSignal;
+				Settings_Save(&settingsStore, &settings);
+				EXTI->PR = EXTI_PR_PR1 | EXTI_PR_PR2; //Writing 1 clears, a USER press (PR0) is kept
+				measureReset = 1;
+				NVIC_EnableIRQ(EXTI0_1_IRQn);
+				NVIC_EnableIRQ(EXTI2_3_IRQn);
+			}
+		}
+		if(filterOverruns != overrunsReported)
+		{
+			overrunsReported = filterOverruns;
+			trace_printf("Filter overruns: %u\n", (unsigned int)overrunsReported);
+		}
 		refresh_OLED();
-		DAC->DHR12R1 = val;
-		//trace_printf("DAC Value: %d\n", converted_val);
+		if(Capture_Full()) //Always false unless built with CAPTURE_EDGES
+		{
+			Capture_Dump(&settings);
+		}
 	}
 }
 
@@ -519,88 +800,40 @@ int main(int argc, char* argv[])
 //
 // LED Display Functions
 //
-void refresh_OLED( void )
+void refresh_OLED_Line( unsigned char page, const unsigned char *Buffer )
 {
-	// Buffer size = at most 16 characters per PAGE + terminating '\0'
-	unsigned char Buffer[17];
+	// 16 characters of 8 columns each, sent to the LED Display as one span
+	unsigned char Glyphs[16 * 8];
+	unsigned int length = 0;
 
-	//Line 1:
-	snprintf( Buffer, sizeof( Buffer ), "R: %5u Ohms", Res );
-	/* Buffer now contains your character ASCII codes for LED Display
+	/* Buffer contains the character ASCII codes for one LED Display line
 	  - select PAGE (LED Display line) and set starting SEG (column)
 	  - for each c = ASCII code = Buffer[0], Buffer[1], ...,
-		  send 8 bytes in Characters[c][0-7] to LED Display
+		  copy the 8 bytes in Characters[c][0-7] into Glyphs
 	*/
-	oled_Write_Cmd(0xB0); // Select PAGE
-	oled_Write_Cmd(0x02); // Lower SEG start address
-	oled_Write_Cmd(0x10); // Higher SEG start address
-	for(unsigned int x = 0; Buffer[x] != '\0'; x++)
+	unsigned char cmds[] = { page, 0x02, 0x10 }; // Select PAGE, lower and higher SEG start address
+	for(unsigned int x = 0; Buffer[x] != '\0' && length < sizeof( Glyphs ); x++)
 	{
-		unsigned char c = Buffer[x];
-		for(unsigned int y = 0; y < 8; y++)
-		{
-			oled_Write_Data(Characters[c][y]); //
-		}
+		memcpy( &Glyphs[length], Characters[Buffer[x]], 8 );
+		length += 8;
 	}
-
-
-	//Line 2:
-	snprintf( Buffer, sizeof( Buffer ), "F: %5u Hz", Freq );
-	/* Buffer now contains your character ASCII codes for LED Display
-	  - select PAGE (LED Display line) and set starting SEG (column)
-	  - for each c = ASCII code = Buffer[0], Buffer[1], ...,
-		  send 8 bytes in Characters[c][0-7] to LED Display
-	*/
-   oled_Write_Cmd(0xB1); // Select PAGE
-   oled_Write_Cmd(0x02); // Lower SEG start address
-   oled_Write_Cmd(0x10); // Higher SEG start address
-   for(unsigned int x = 0; Buffer[x] != '\0'; x++)
-   {
-	   unsigned char c = Buffer[x];
-	   for(unsigned int y = 0; y < 8; y++)
-	   {
-		   oled_Write_Data(Characters[c][y]);
-	   }
-   }
-
+	oled_Write_Cmd_Span( cmds, sizeof( cmds ) );
+	oled_Write_Data_Span( Glyphs, length );
 }
 
 
-void oled_Write_Cmd( unsigned char cmd )
-{
-	//trace_printf("Made it to oled_write_cmd\n");
-
-	GPIOB->ODR |= (1 << 6);  // make PB6 = CS# = 1
-	GPIOB->ODR &= ~(1 << 7); // make PB7 = D/C# = 0
-	GPIOB->ODR &= ~(1 << 6); // make PB6 = CS# = 0
-	oled_Write( cmd );
-	GPIOB->ODR |= (1<<6); // make PB6 = CS# = 1
-}
-
-
-void oled_Write_Data( unsigned char data )
+void refresh_OLED( void )
 {
-	GPIOB->ODR |= (1 << 6); // make PB6 = CS# = 1
-	GPIOB->ODR |= (1 << 7); // make PB7 = D/C# = 1
-	GPIOB->ODR &= ~(1 << 6); // make PB6 = CS# = 0
-
-	oled_Write( data );
-	GPIOB->ODR |= (1 << 6); // make PB6 = CS# = 1
-}
+	// Buffer size = at most 16 characters per PAGE + terminating '\0'
+	unsigned char Buffer[17];
 
+	//Line 1:
+	snprintf( Buffer, sizeof( Buffer ), "R: %5u Ohms", Res );
+	refresh_OLED_Line( 0xB0, Buffer );
 
-void oled_Write( unsigned char Value )
-{
-/* Wait until SPI1 is ready for writing (TXE = 1 in SPI1_SR) */
-	while(!(SPI1->SR & SPI_SR_TXE))
-		{
-		trace_printf("Stuck\n");;
-		}
-	/* Send one 8-bit character:
-	  - This function also set BIDIOE = 1 in SPI1_CR1
-	*/
-	HAL_SPI_Transmit( &SPI_Handle, &Value, 1, HAL_MAX_DELAY );
-	while(SPI1->SR & SPI_SR_BSY); //wait for SPI BSY to not be busy
+	//Line 2:
+	snprintf( Buffer, sizeof( Buffer ), "F: %5u Hz", Freq );
+	refresh_OLED_Line( 0xB1, Buffer );
 }
 
 
@@ -625,22 +858,19 @@ void oled_config( void )
 
 	trace_printf("Start2\n");
 
-	SPI_Handle.Instance = SPI1;
-	SPI_Handle.Init.Direction = SPI_DIRECTION_1LINE;
-	SPI_Handle.Init.Mode = SPI_MODE_MASTER;
-	SPI_Handle.Init.DataSize = SPI_DATASIZE_8BIT;
-	SPI_Handle.Init.CLKPolarity = SPI_POLARITY_LOW;
-	SPI_Handle.Init.CLKPhase = SPI_PHASE_1EDGE;
-	SPI_Handle.Init.NSS = SPI_NSS_SOFT;
-	SPI_Handle.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_256;
-	SPI_Handle.Init.FirstBit = SPI_FIRSTBIT_MSB;
-	SPI_Handle.Init.CRCPolynomial = 7;
-
-	// Initialize the SPI interface
-	HAL_SPI_Init( &SPI_Handle );
+	/* Configure SPI1 directly:
+	  - 1-line bidirectional, transmit only (BIDIMODE = 1, BIDIOE = 1)
+	  - master, software NSS, CPOL = 0, CPHA = 0, MSB first
+	  - SCK = 48 MHz / 8 = 6 MHz, the SSD1306 allows at most 10 MHz
+	  - 8 bit frames, oled_Write() packs two of them per FIFO write
+	*/
+	SPI1->CR1 = 0;
+	SPI1->CR1 = SPI_CR1_BIDIMODE | SPI_CR1_BIDIOE | SPI_CR1_MSTR
+		| SPI_CR1_SSM | SPI_CR1_SSI | SPI_CR1_BR_1;
+	SPI1->CR2 = SPI_CR2_DS_2 | SPI_CR2_DS_1 | SPI_CR2_DS_0;
 
 	// Enable the SPI
-	__HAL_SPI_ENABLE( &SPI_Handle );
+	SPI1->CR1 |= SPI_CR1_SPE;
 
 	/* Reset LED Display (RES# = PB4):
 	  - make pin PB4 = 0, wait for a few ms
@@ -654,26 +884,21 @@ void oled_config( void )
 	trace_printf("Start4\n");
 
 	// Send initialization commands to LED Display
-	for ( unsigned int i = 0; i < sizeof( oled_init_cmds ); i++ )
-	{
-		  //trace_printf("oled_init_cmds size = %d\n", sizeof(oled_init_cmds[i]));
-	      oled_Write_Cmd( oled_init_cmds[i] );
-	}
+	oled_Write_Cmd_Span( oled_init_cmds, sizeof( oled_init_cmds ) );
 
 	/* Fill LED Display data memory (GDDRAM) with zeros:
 	  - for each PAGE = 0, 1, ..., 7
 		  set starting SEG = 0
-		  call oled_Write_Data( 0x00 ) 128 times
+		  send 128 zero bytes as one data span
 	*/
 	//Clearing:
+	unsigned char zeros[128];
+	memset( zeros, 0, sizeof( zeros ) );
 	for(int x = 0; x < 8; x++)
 	{
-		  oled_Write_Cmd(0xB0 + x);
-		  oled_Write_Cmd(0x00);
-		  oled_Write_Cmd(0x10);
-		  for (int y = 0; y < 128; y++) {
-			  oled_Write_Data(0x00);
-		  }
+		  unsigned char cmds[] = { 0xB0 + x, 0x00, 0x10 };
+		  oled_Write_Cmd_Span( cmds, sizeof( cmds ) );
+		  oled_Write_Data_Span( zeros, sizeof( zeros ) );
 	}
 	trace_printf("End of config\n");
 }
@@ -696,39 +921,33 @@ void EXTI0_1_IRQHandler(void)
 	//trace_printf("Interrupt called\n");
 	if(EXTI->PR & EXTI_PR_PR1)
 	{
-		double float_frequency;
-		double float_scaledPeriod;
-		unsigned int frequency;
-		unsigned int scaledPeriod;
-		if(!timerTriggered)
-		      {
-		          TIM2->CNT = 0;
-		          TIM2->CR1 |= TIM_CR1_CEN;
-		          timerTriggered = 1;
-		      }
-				//    Else (this is the second edge):
-				//	- Stop timer (TIM2->CR1).
-				//	- Read out count register (TIM2->CNT).
-				//	- Calculate signal period and frequency.
-				//	- Print calculated values to the console.
-				//	  NOTE: Function trace_printf does not work
-				//	  with floating-point numbers: you must use
-				//	  "unsigned int" type to print your signal
-				//	  period and frequency.
-		      else
-		      {
-					TIM2->CR1 &= ~(TIM_CR1_CEN);
-					uint32_t timerValue = TIM2->CNT;
-					float_frequency = 48000000 / timerValue;
-					float_scaledPeriod = 1/float_frequency;
-					frequency = float_frequency;
-					//trace_printf("555 Frequency: %u.%02u Hz\n", frequency, frequency % 100);
-					Freq = frequency;
-				    Res = (ADC1->DR * 5000) / 4095;
-					//trace_printf("Resistance: %.2f\n", Res);
-					timerTriggered = 0;
-
-		      }
+		//Same edge pairing as EXTI2, but the 555 timer reading also publishes the resistance
+		uint32_t counts = TIM2->CNT;
+		uint16_t adc = ADC1->DR;
+		uint8_t reset = measureReset;
+		if(reset)
+		{
+			measureReset = 0;
+			Measure_Reset(&measure);
+		}
+		Capture_Edge(1, counts, adc, reset, &measure);
+		int result = Measure_Edge(&measure, counts, adc, &settings);
+		if(result == MEASURE_ARMED)
+		{
+			TIM2->CNT = 0;
+			TIM2->CR1 |= TIM_CR1_CEN;
+		}
+		else if(result == MEASURE_PUBLISHED)
+		{
+			TIM2->CR1 &= ~(TIM_CR1_CEN);
+			//trace_printf("555 Frequency: %u Hz\n", measure.freq);
+			Freq = measure.freq;
+			Res = measure.res;
+		}
+		else if(result == MEASURE_FILLING)
+		{
+			TIM2->CR1 &= ~(TIM_CR1_CEN);
+		}
 		EXTI->PR |= EXTI_PR_PR1; //Clear pending flag
 	}
 
@@ -740,13 +959,18 @@ void EXTI0_1_IRQHandler(void)
 			EXTI->IMR &= ~EXTI_IMR_MR1; //Disable interrupt for EXTI1
 			EXTI->IMR |= EXTI_IMR_MR2;  //Enable interrupt for EXTI2
 			trace_printf("Function generator enabled\n");
+			settingsDirty = 1;
 		}else if(globalSignal == 1)
 		{
 			globalSignal = 0;
 			EXTI->IMR &= ~EXTI_IMR_MR2; //Disable interrupt for EXTI2
 			EXTI->IMR |= EXTI_IMR_MR1;  //Enable interrupt for EXTI1
 			trace_printf("555 timer enabled\n");
+			settingsDirty = 1;
 		}
+		//Don't let the median mix periods from both sources. The edge handlers do the
+		//reset just before they feed the next edge in, so it never splits a Measure_Edge()
+		measureReset = 1;
 		EXTI->PR |= EXTI_PR_PR0; //Clear EXTI0 Pending flag
 	}
 
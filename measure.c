@@ -0,0 +1,162 @@
+//
+// Measurement core: edge pairing, glitch rejection, period to frequency,
+// resistance and running statistics.
+//
+#include "measure.h"
+
+/* Compare and swap, the building block of the median networks below */
+#define MEASURE_SORT2(a, b) do { if ((a) > (b)) { uint32_t t_ = (a); (a) = (b); (b) = t_; } } while (0)
+
+
+void Measure_Init(Measure *measure, const Settings *settings)
+{
+	Measure_Reset(measure);
+	measure->minCounts = settings->timerClockHz / MEASURE_MAX_FREQ_HZ;
+	measure->freq = 0;
+	measure->res = 0;
+	measure->stats.count = 0;
+	measure->stats.min = 0;
+	measure->stats.max = 0;
+	measure->stats.sum = 0;
+	measure->stats.rejected = 0;
+}
+
+
+//
+// Forgets the open pair and the median window, e.g. when the input source
+// changes, but keeps the statistics.
+//
+void Measure_Reset(Measure *measure)
+{
+	measure->armed = 0;
+	measure->filled = 0;
+	measure->next = 0;
+}
+
+
+//
+// Median of the period window. Fixed compare and swap networks keep the
+// cost constant, which matters inside the EXTI handlers.
+//
+static uint32_t measure_median(const Measure *measure)
+{
+#if MEASURE_MEDIAN_WINDOW == 1
+	return measure->window[0];
+#elif MEASURE_MEDIAN_WINDOW == 3
+	uint32_t a = measure->window[0], b = measure->window[1], c = measure->window[2];
+	MEASURE_SORT2(a, b);
+	MEASURE_SORT2(b, c);
+	MEASURE_SORT2(a, b);
+	return b;
+#else
+	uint32_t a = measure->window[0], b = measure->window[1], c = measure->window[2];
+	uint32_t d = measure->window[3], e = measure->window[4];
+	MEASURE_SORT2(a, b);
+	MEASURE_SORT2(d, e);
+	MEASURE_SORT2(a, d); // a is now below the median, drop it
+	MEASURE_SORT2(b, e); // e is now above the median, drop it
+	MEASURE_SORT2(b, c);
+	MEASURE_SORT2(c, d);
+	MEASURE_SORT2(b, c);
+	return c;
+#endif
+}
+
+
+static void measure_push(Measure *measure, uint32_t counts)
+{
+	if (measure->filled < MEASURE_MEDIAN_WINDOW)
+	{
+		measure->filled++;
+	}
+	measure->window[measure->next] = counts;
+	measure->next = (measure->next + 1 == MEASURE_MEDIAN_WINDOW) ? 0 : measure->next + 1;
+}
+
+
+//
+// Converts a TIM2 count between two rising edges into a frequency in Hz.
+// A zero count cannot come from a real signal and gives 0 Hz.
+//
+unsigned int Measure_Frequency(uint32_t counts, uint32_t clockHz)
+{
+	if (counts == 0)
+	{
+		return 0;
+	}
+	return clockHz / counts;
+}
+
+
+//
+// Converts a 12 bit ADC reading of the potentiometer into Ohms, after
+// removing the calibrated ADC offset.
+//
+unsigned int Measure_Resistance(uint16_t adc, const Settings *settings)
+{
+	int32_t value = (int32_t)adc - settings->adcOffset;
+
+	if (value < 0)
+	{
+		value = 0;
+	}
+	return ((uint32_t)value * settings->resFullScaleOhms) / SETTINGS_ADC_FULL_SCALE;
+}
+
+
+//
+// Feeds one rising edge into the measurement. counts is the TIM2 count at
+// the edge and is only used on the second edge of a pair. Returns
+// MEASURE_ARMED when the caller must restart the timer, MEASURE_PUBLISHED
+// when freq, res and stats hold a new reading, or MEASURE_REJECTED when the
+// edge was a glitch and the timer must keep running. MEASURE_FILLING ends
+// a pair like MEASURE_PUBLISHED, but publishes nothing while the median
+// window refills after a reset.
+//
+int Measure_Edge(Measure *measure, uint32_t counts, uint16_t adc, const Settings *settings)
+{
+	if (!measure->armed)
+	{
+		measure->armed = 1;
+		return MEASURE_ARMED;
+	}
+
+	if (counts < measure->minCounts)
+	{
+		measure->stats.rejected++;
+		return MEASURE_REJECTED;
+	}
+
+	measure->armed = 0;
+	measure_push(measure, counts);
+	if (measure->filled < MEASURE_MEDIAN_WINDOW)
+	{
+		return MEASURE_FILLING;
+	}
+	measure->freq = Measure_Frequency(measure_median(measure), settings->timerClockHz);
+	measure->res = Measure_Resistance(adc, settings);
+
+	MeasureStats *stats = &measure->stats;
+	if (stats->count == 0 || measure->freq < stats->min)
+	{
+		stats->min = measure->freq;
+	}
+	if (stats->count == 0 || measure->freq > stats->max)
+	{
+		stats->max = measure->freq;
+	}
+	stats->sum += measure->freq;
+	stats->count++;
+
+	return MEASURE_PUBLISHED;
+}
+
+
+unsigned int Measure_Mean(const MeasureStats *stats)
+{
+	if (stats->count == 0)
+	{
+		return 0;
+	}
+	return (unsigned int)(stats->sum / stats->count);
+}
@@ -0,0 +1,67 @@
+//
+// Measurement core: edge pairing, glitch rejection, period to frequency,
+// resistance and running statistics.
+//
+// A period shorter than 1 / MEASURE_MAX_FREQ_HZ cannot come from the signal,
+// so the edge that ended it is dropped and the pair stays open. Accepted
+// periods then go through a sliding median, so a single stray edge that
+// still looks like a plausible period never reaches the display. After a
+// reset nothing is published until the window is full again, so the first
+// period cannot decide the median on its own.
+//
+// This is plain C with no register access, so the EXTI handlers and the
+// host replay tool (tools/replay.c) run exactly the same code.
+//
+#ifndef MEASURE_H_
+#define MEASURE_H_
+
+#include <stdint.h>
+#include "settings.h"
+
+/* Glitch rejection, override with -D on the command line */
+#ifndef MEASURE_MEDIAN_WINDOW
+#define MEASURE_MEDIAN_WINDOW 3 // Periods in the sliding median: 1 (off), 3 or 5
+#endif
+#ifndef MEASURE_MAX_FREQ_HZ
+#define MEASURE_MAX_FREQ_HZ ((uint32_t)100000) // Shorter periods are treated as glitches
+#endif
+
+#if MEASURE_MEDIAN_WINDOW != 1 && MEASURE_MEDIAN_WINDOW != 3 && MEASURE_MEDIAN_WINDOW != 5
+#error "MEASURE_MEDIAN_WINDOW must be 1, 3 or 5"
+#endif
+
+/* Results of Measure_Edge() */
+#define MEASURE_ARMED ((int)0)     // First edge of a pair: reset and start TIM2
+#define MEASURE_PUBLISHED ((int)1) // Second edge: stop TIM2, freq and res are new
+#define MEASURE_REJECTED ((int)2)  // Glitch: leave TIM2 running, the pair is still open
+#define MEASURE_FILLING ((int)3)   // Second edge, but the median window is not full yet: stop TIM2
+
+typedef struct
+{
+	uint32_t count;  // Number of published readings
+	unsigned int min;
+	unsigned int max;
+	uint64_t sum;    // Sum of all published frequencies, for the mean
+	uint32_t rejected; // Edges dropped by the minimum period check
+} MeasureStats;
+
+typedef struct
+{
+	uint8_t armed;     // Set between the first and the second edge of a pair
+	uint8_t filled;    // Periods held in window, up to MEASURE_MEDIAN_WINDOW
+	uint8_t next;      // Slot in window for the next period
+	uint32_t minCounts; // Shortest accepted period, from MEASURE_MAX_FREQ_HZ
+	uint32_t window[MEASURE_MEDIAN_WINDOW]; // Last accepted periods in TIM2 counts
+	unsigned int freq; // Last published frequency in Hz
+	unsigned int res;  // Last published resistance in Ohms
+	MeasureStats stats;
+} Measure;
+
+void Measure_Init(Measure *measure, const Settings *settings);
+void Measure_Reset(Measure *measure);
+unsigned int Measure_Frequency(uint32_t counts, uint32_t clockHz);
+unsigned int Measure_Resistance(uint16_t adc, const Settings *settings);
+int Measure_Edge(Measure *measure, uint32_t counts, uint16_t adc, const Settings *settings);
+unsigned int Measure_Mean(const MeasureStats *stats);
+
+#endif // MEASURE_H_
@@ -0,0 +1,66 @@
+//
+// SPI1 transport for the SSD1306 LED Display.
+//
+#include <stdint.h>
+#include "oled.h"
+
+#ifndef OLED_SPI_SR
+#include "cmsis/cmsis_device.h"
+
+/* SPI1 status and data registers */
+#define OLED_SPI_SR() (SPI1->SR)
+#define OLED_SPI_WRITE16(value) (*(__IO uint16_t *)&SPI1->DR = (value)) // Queues two 8 bit frames
+#define OLED_SPI_WRITE8(value) (*(__IO uint8_t *)&SPI1->DR = (value))   // Queues a single frame
+
+/* CS# = PB6, D/C# = PB7 */
+#define OLED_CS_HIGH() (GPIOB->ODR |= (1 << 6))
+#define OLED_CS_LOW() (GPIOB->ODR &= ~(1 << 6))
+#define OLED_DC_CMD() (GPIOB->ODR &= ~(1 << 7))
+#define OLED_DC_DATA() (GPIOB->ODR |= (1 << 7))
+#endif
+
+
+void oled_Write_Cmd_Span( const unsigned char *cmds, unsigned int length )
+{
+	OLED_CS_HIGH();  // make PB6 = CS# = 1
+	OLED_DC_CMD();   // make PB7 = D/C# = 0
+	OLED_CS_LOW();   // make PB6 = CS# = 0
+	oled_Write( cmds, length );
+	OLED_CS_HIGH();  // make PB6 = CS# = 1
+}
+
+
+void oled_Write_Data_Span( const unsigned char *data, unsigned int length )
+{
+	OLED_CS_HIGH();  // make PB6 = CS# = 1
+	OLED_DC_DATA();  // make PB7 = D/C# = 1
+	OLED_CS_LOW();   // make PB6 = CS# = 0
+	oled_Write( data, length );
+	OLED_CS_HIGH();  // make PB6 = CS# = 1
+}
+
+
+void oled_Write( const unsigned char *bytes, unsigned int length )
+{
+	/* With 8 bit frames, a 16 bit write to SPI1_DR queues two frames
+	   (low byte first). TXE means the 32 bit TX FIFO is at most half
+	   full, so there is always room for the next pair of bytes.
+	*/
+	while(length >= 2)
+	{
+		while(!(OLED_SPI_SR() & SPI_SR_TXE));
+		OLED_SPI_WRITE16( (uint16_t)(bytes[0] | (bytes[1] << 8)) );
+		bytes += 2;
+		length -= 2;
+	}
+	if(length)
+	{
+		while(!(OLED_SPI_SR() & SPI_SR_TXE));
+		OLED_SPI_WRITE8( bytes[0] );
+	}
+	/* Wait for the FIFO to drain and the last frame to leave before
+	   the caller changes CS# or D/C#
+	*/
+	while(OLED_SPI_SR() & SPI_SR_FTLVL);
+	while(OLED_SPI_SR() & SPI_SR_BSY);
+}
@@ -0,0 +1,16 @@
+//
+// SPI1 transport for the SSD1306 LED Display.
+//
+// Bytes go out in spans: CS# and D/C# are set once per span and the TX
+// FIFO is fed two bytes per write. SPI1 is set up by oled_config() in
+// main.c. oled.c only touches the peripheral through the OLED_* access
+// macros, so tools/spi_bench.c can run it against a fake SPI1.
+//
+#ifndef OLED_H_
+#define OLED_H_
+
+void oled_Write(const unsigned char *bytes, unsigned int length);
+void oled_Write_Cmd_Span(const unsigned char *cmds, unsigned int length);
+void oled_Write_Data_Span(const unsigned char *data, unsigned int length);
+
+#endif // OLED_H_
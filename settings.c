@@ -0,0 +1,188 @@
+//
+// Persistent settings and calibration stored in the last flash pages.
+//
+// Two pages are used as an emulated EEPROM. Records are appended to the
+// active page until it is full, then the other page is erased and becomes
+// the active one, so each page is only erased once every slotsPerPage
+// saves. No register access here: flash goes through store->flash.
+//
+#include <stddef.h>
+#include "settings.h"
+
+/* Value of an erased flash halfword */
+#define FLASH_ERASED ((uint16_t)0xFFFF)
+
+typedef struct
+{
+	uint16_t version;     // SETTINGS_VERSION, FLASH_ERASED marks a free slot
+	uint16_t sequence;    // Incremented on every save, the newest record wins
+	uint32_t timerClockHz;
+	int16_t adcOffset;
+	uint16_t resFullScaleOhms;
+	uint8_t mode;
+	uint8_t reserved;
+	uint16_t crc;         // CRC-16/CCITT over every field above
+} SettingsRecord;
+
+_Static_assert(sizeof(SettingsRecord) == SETTINGS_RECORD_BYTES, "SettingsRecord layout changed");
+
+#define SETTINGS_RECORD_HALFWORDS (sizeof(SettingsRecord) / 2)
+
+
+static uint16_t settings_crc16(const uint8_t *data, size_t length)
+{
+	uint16_t crc = 0xFFFF;
+
+	while (length--)
+	{
+		crc ^= (uint16_t)(*data++) << 8;
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+		}
+	}
+	return crc;
+}
+
+
+static uint32_t settings_slots(const SettingsStore *store)
+{
+	return store->flash->pageSize / sizeof(SettingsRecord);
+}
+
+
+static uintptr_t settings_slot(const SettingsStore *store, uint8_t page, uint32_t slot)
+{
+	return store->flash->pages[page] + slot * sizeof(SettingsRecord);
+}
+
+
+static int settings_record_valid(const SettingsRecord *record)
+{
+	return record->version == SETTINGS_VERSION
+		&& record->crc == settings_crc16((const uint8_t *)record, offsetof(SettingsRecord, crc));
+}
+
+
+void Settings_Defaults(Settings *settings)
+{
+	settings->timerClockHz = SETTINGS_DEFAULT_TIMER_CLOCK_HZ;
+	settings->adcOffset = SETTINGS_DEFAULT_ADC_OFFSET;
+	settings->resFullScaleOhms = SETTINGS_DEFAULT_RES_FULL_SCALE;
+	settings->mode = SETTINGS_DEFAULT_MODE;
+}
+
+
+void Settings_Init(SettingsStore *store, const SettingsFlash *flash)
+{
+	store->flash = flash;
+	store->activePage = 1;
+	store->nextSlot = 0;
+	store->lastSequence = 0;
+	store->scanned = 0;
+}
+
+
+//
+// Loads the newest valid record into settings. Returns 0 on success, or -1
+// if flash holds no valid record, in which case settings get the defaults.
+//
+int Settings_Load(SettingsStore *store, Settings *settings)
+{
+	SettingsRecord record;
+	SettingsRecord newest;
+	uint32_t usedSlots[2];
+	uint8_t newestPage = 0;
+	int found = 0;
+
+	Settings_Defaults(settings);
+
+	for (uint8_t p = 0; p < 2; p++)
+	{
+		// Records are appended in order, so the first free slot ends the page
+		uint32_t slot = 0;
+		for (; slot < settings_slots(store); slot++)
+		{
+			store->flash->read(settings_slot(store, p, slot), &record, sizeof(record));
+			if (record.version == FLASH_ERASED)
+			{
+				break;
+			}
+			// Sequence numbers wrap, so compare them as a signed difference
+			if (settings_record_valid(&record)
+				&& (!found || (int16_t)(record.sequence - newest.sequence) > 0))
+			{
+				newest = record;
+				newestPage = p;
+				found = 1;
+			}
+		}
+		usedSlots[p] = slot;
+	}
+
+	// Without a valid record, the first save erases and starts page 0
+	store->activePage = found ? newestPage : 1;
+	store->nextSlot = found ? usedSlots[newestPage] : settings_slots(store);
+	store->lastSequence = found ? newest.sequence : 0;
+	store->scanned = 1;
+
+	if (!found)
+	{
+		return -1;
+	}
+
+	settings->timerClockHz = newest.timerClockHz;
+	settings->adcOffset = newest.adcOffset;
+	settings->resFullScaleOhms = newest.resFullScaleOhms;
+	settings->mode = newest.mode;
+	return 0;
+}
+
+
+//
+// Appends settings as a new record. Erases the other page first when the
+// active page is full. Returns 0 on success or -1 on a flash error.
+//
+int Settings_Save(SettingsStore *store, const Settings *settings)
+{
+	SettingsRecord record;
+	int result = 0;
+
+	if (!store->scanned)
+	{
+		Settings scratch;
+		Settings_Load(store, &scratch);
+	}
+
+	record.version = SETTINGS_VERSION;
+	record.sequence = (uint16_t)(store->lastSequence + 1);
+	record.timerClockHz = settings->timerClockHz;
+	record.adcOffset = settings->adcOffset;
+	record.resFullScaleOhms = settings->resFullScaleOhms;
+	record.mode = settings->mode;
+	record.reserved = 0xFF;
+	record.crc = settings_crc16((const uint8_t *)&record, offsetof(SettingsRecord, crc));
+
+	if (store->nextSlot >= settings_slots(store))
+	{
+		// Active page is full: move to the other one. The old page keeps the
+		// previous record until the swap back, in case this save is torn.
+		store->activePage ^= 1;
+		store->nextSlot = 0;
+		result = store->flash->erase(store->flash->pages[store->activePage]);
+	}
+
+	if (result == 0)
+	{
+		// The version halfword goes first, so a torn write still uses up the slot
+		result = store->flash->program(settings_slot(store, store->activePage, store->nextSlot),
+			(const uint16_t *)&record, SETTINGS_RECORD_HALFWORDS);
+		store->nextSlot++;
+	}
+
+	if (result == 0)
+	{
+		store->lastSequence = record.sequence;
+	}
+	return result ? -1 : 0;
+}
@@ -0,0 +1,66 @@
+//
+// Persistent settings and calibration stored in the last flash pages.
+//
+// Records are appended to one of two 1 KB pages (emulated EEPROM). Each
+// record carries a format version, a sequence number and a CRC-16, so a
+// torn write or a stale format is simply skipped on the next boot.
+//
+// The store only touches flash through a SettingsFlash, so the record
+// format and wear-levelling run unchanged on the host against a RAM
+// array (tools/settings_check.c). settings_flash.c has the STM32F0 one.
+//
+#ifndef SETTINGS_H_
+#define SETTINGS_H_
+
+#include <stdint.h>
+
+/* Bump when the layout of SettingsRecord changes; old records are ignored */
+#define SETTINGS_VERSION ((uint16_t)0x0001)
+
+/* Size of one record in flash, see SettingsRecord in settings.c */
+#define SETTINGS_RECORD_BYTES 16
+
+/* Defaults used when no valid record is found in flash */
+#define SETTINGS_DEFAULT_TIMER_CLOCK_HZ ((uint32_t)48000000)
+#define SETTINGS_DEFAULT_ADC_OFFSET ((int16_t)0)
+#define SETTINGS_DEFAULT_RES_FULL_SCALE ((uint16_t)5000)
+#define SETTINGS_DEFAULT_MODE ((uint8_t)1)
+
+/* ADC full scale for the 12 bit right aligned conversion */
+#define SETTINGS_ADC_FULL_SCALE ((uint16_t)4095)
+
+typedef struct
+{
+	uint32_t timerClockHz;     // TIM2 input clock, trimmed against a reference
+	int16_t adcOffset;         // ADC zero offset in counts, subtracted from ADC1->DR
+	uint16_t resFullScaleOhms; // Potentiometer resistance at ADC full scale
+	uint8_t mode;              // Last value of globalSignal (1 = function generator, 0 = 555 timer)
+} Settings;
+
+typedef struct
+{
+	uintptr_t pages[2]; // Base addresses of the two settings pages
+	uint32_t pageSize;  // Bytes per page, a multiple of SETTINGS_RECORD_BYTES
+	void (*read)(uintptr_t address, void *data, uint32_t bytes);
+	int (*erase)(uintptr_t page); // Sets the page to 0xFF, 0 on success
+	int (*program)(uintptr_t address, const uint16_t *data, uint32_t halfwords); // 0 on success
+} SettingsFlash;
+
+typedef struct
+{
+	const SettingsFlash *flash;
+	uint8_t activePage;    // Index into flash->pages of the page being appended to
+	uint32_t nextSlot;     // Where the next record goes in the active page
+	uint16_t lastSequence; // Sequence number of the newest record
+	uint8_t scanned;       // Set once Settings_Load() has found the above
+} SettingsStore;
+
+/* The last two pages of the STM32F051R8 flash, see settings_flash.c */
+extern const SettingsFlash Settings_Flash;
+
+void Settings_Defaults(Settings *settings);
+void Settings_Init(SettingsStore *store, const SettingsFlash *flash);
+int Settings_Load(SettingsStore *store, Settings *settings);
+int Settings_Save(SettingsStore *store, const Settings *settings);
+
+#endif // SETTINGS_H_
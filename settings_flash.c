@@ -0,0 +1,92 @@
+//
+// SettingsFlash for the STM32F0 on-chip flash.
+//
+// Uses the last two 1 KB pages of the 64 KB flash. The linker script must
+// keep code out of these two pages.
+//
+#include <string.h>
+#include "cmsis/cmsis_device.h"
+#include "settings.h"
+
+/* Last two pages of the STM32F051R8 64 KB flash */
+#define SETTINGS_PAGE_SIZE ((uint32_t)0x400)
+#define SETTINGS_PAGE_0 ((uintptr_t)0x0800F800)
+#define SETTINGS_PAGE_1 ((uintptr_t)0x0800FC00)
+
+
+static void flash_unlock(void)
+{
+	if (FLASH->CR & FLASH_CR_LOCK)
+	{
+		FLASH->KEYR = FLASH_FKEY1;
+		FLASH->KEYR = FLASH_FKEY2;
+	}
+}
+
+
+static void flash_lock(void)
+{
+	FLASH->CR |= FLASH_CR_LOCK;
+}
+
+
+static int flash_wait(void)
+{
+	while (FLASH->SR & FLASH_SR_BSY); // Wait for the current operation to finish
+
+	uint32_t status = FLASH->SR;
+	FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPRTERR; // Flags are cleared by writing 1
+	return (status & (FLASH_SR_PGERR | FLASH_SR_WRPRTERR)) ? -1 : 0;
+}
+
+
+static void flash_read(uintptr_t address, void *data, uint32_t bytes)
+{
+	// Flash is memory mapped
+	memcpy(data, (const void *)address, bytes);
+}
+
+
+static int flash_erase_page(uintptr_t page)
+{
+	flash_unlock();
+	FLASH->CR |= FLASH_CR_PER;
+	FLASH->AR = page;
+	FLASH->CR |= FLASH_CR_STRT;
+	int result = flash_wait();
+	FLASH->CR &= ~(FLASH_CR_PER);
+	flash_lock();
+	return result;
+}
+
+
+static int flash_program(uintptr_t address, const uint16_t *data, uint32_t halfwords)
+{
+	int result = 0;
+
+	flash_unlock();
+	FLASH->CR |= FLASH_CR_PG;
+	for (uint32_t i = 0; i < halfwords && result == 0; i++)
+	{
+		// The F0 only programs one halfword at a time
+		*(volatile uint16_t *)(address + 2 * i) = data[i];
+		result = flash_wait();
+		if (*(volatile uint16_t *)(address + 2 * i) != data[i])
+		{
+			result = -1;
+		}
+	}
+	FLASH->CR &= ~(FLASH_CR_PG);
+	flash_lock();
+	return result;
+}
+
+
+const SettingsFlash Settings_Flash =
+{
+	{ SETTINGS_PAGE_0, SETTINGS_PAGE_1 },
+	SETTINGS_PAGE_SIZE,
+	flash_read,
+	flash_erase_page,
+	flash_program
+};
@@ -0,0 +1,343 @@
+//
+// Coefficient generator and host check for the filter stage.
+//
+// Designs a Hamming windowed-sinc decimating FIR (Q15) and an RBJ
+// Butterworth-style lowpass biquad (Q14), prints them as a FilterPreset
+// initializer for filter.c, then runs test vectors through the fixed-point
+// filter.c code to report the response it really gets and its speed.
+//
+// The response is checked on a grid up to the output Nyquist and around
+// both cutoffs. The tool exits with 1 if design and measurement differ by
+// more than CHECK_TOLERANCE_DB anywhere above CHECK_FLOOR_DB, or if the
+// Cortex-M0 cycle estimate for one block does not fit the time the TIM3
+// handler takes to fill it.
+//
+// Build on Linux from the repository root:
+//   gcc -O2 -I. -o filter_design tools/filter_design.c filter.c -lm
+//
+// Usage:
+//   filter_design <name> <fsHz> <decimation> <firTaps> <firCutoffHz> <biquadCutoffHz> [Q]
+//
+//   firTaps 1 skips the FIR, biquadCutoffHz 0 skips the biquad. The biquad
+//   cutoff is designed against the decimated rate fsHz / decimation.
+//
+#define _POSIX_C_SOURCE 199309L
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "filter.h"
+
+#define TEST_BLOCK 32
+#define TEST_SAMPLES (1 << 20)
+#define TEST_MID 2048      // Sine offset, mid scale of the 12 bit ADC
+#define TEST_AMPLITUDE 1000
+#define TEST_MAX_POINTS 32
+
+/* Below this the output is a few LSBs and the comparison is only noise */
+#define CHECK_FLOOR_DB (-40.0)
+#define CHECK_TOLERANCE_DB 0.1 // Correct presets stay within 0.05 dB
+
+/* Cortex-M0 estimate for the loops in filter.c, in CPU cycles at 48 MHz
+   with one flash wait state: loads and stores 2, ALU and MULS 1, taken
+   branch 3. Budget is one block of TEST_BLOCK samples at fsHz. */
+#define M0_CPU_HZ 48000000.0
+#define M0_FIR_INPUT 24     // Store the sample twice, wrap head, count the phase, loop
+#define M0_FIR_OUTPUT 22    // Window pointer, rounding, shift, saturate, store
+#define M0_FIR_TAP 12       // ldrsh tap, ldrsh sample, muls, adds, pointer, counter, branch
+#define M0_BIQUAD_OUTPUT 60 // Five muls, saturate, error feedback, state spilled to the stack
+#define M0_CLAMP_OUTPUT 14  // ldrsh, two compares, store, loop
+#define M0_BLOCK_CALLS 90   // Three calls, prologues, state loads and stores
+
+static const double pi = 3.14159265358979323846;
+
+
+static int16_t quantize(double value, int fractionBits)
+{
+	double scaled = round(value * (1 << fractionBits));
+	if (scaled > 32767)
+	{
+		scaled = 32767;
+	}
+	if (scaled < -32768)
+	{
+		scaled = -32768;
+	}
+	return (int16_t)scaled;
+}
+
+
+static void design_fir(FilterPreset *preset, double fs, double cutoff)
+{
+	const int n = preset->numTaps;
+	double taps[FILTER_MAX_TAPS];
+	double sum = 0;
+
+	if (n == 1)
+	{
+		preset->taps[0] = 32767;
+		return;
+	}
+	for (int k = 0; k < n; k++)
+	{
+		double m = k - (n - 1) / 2.0;
+		double sinc = (m == 0) ? 2 * cutoff / fs : sin(2 * pi * cutoff / fs * m) / (pi * m);
+		double window = 0.54 - 0.46 * cos(2 * pi * k / (n - 1));
+		taps[k] = sinc * window;
+		sum += taps[k];
+	}
+
+	// Unity DC gain after rounding: give the rounding leftover to the centre
+	// tap, or share it between the two centre taps of an even length filter
+	// so the taps stay symmetric and the phase linear
+	int total = 0;
+	for (int k = 0; k < n; k++)
+	{
+		preset->taps[k] = quantize(taps[k] / sum, 15);
+		total += preset->taps[k];
+	}
+	int leftover = 32768 - total;
+	if (n % 2 == 0)
+	{
+		preset->taps[n / 2 - 1] += (int16_t)(leftover / 2);
+		leftover -= leftover / 2;
+	}
+	preset->taps[n / 2] += (int16_t)leftover;
+}
+
+
+static void design_biquad(BiquadCoeffs *c, double fs, double cutoff, double q)
+{
+	if (cutoff <= 0)
+	{
+		c->b0 = 16384;
+		c->b1 = c->b2 = c->a1 = c->a2 = 0;
+		return;
+	}
+
+	double w0 = 2 * pi * cutoff / fs;
+	double alpha = sin(w0) / (2 * q);
+	double a0 = 1 + alpha;
+	c->b0 = quantize((1 - cos(w0)) / 2 / a0, 14);
+	c->b1 = quantize((1 - cos(w0)) / a0, 14);
+	c->b2 = c->b0;
+	c->a1 = quantize(-2 * cos(w0) / a0, 14);
+	c->a2 = quantize((1 - alpha) / a0, 14);
+}
+
+
+//
+// Magnitude of the quantized FIR and biquad at f, each at its own rate.
+//
+static double response(const FilterPreset *preset, double fs, double f)
+{
+	double re = 0, im = 0;
+	double w = 2 * pi * f / fs;
+
+	for (int k = 0; k < preset->numTaps; k++)
+	{
+		re += preset->taps[k] / 32768.0 * cos(w * k);
+		im -= preset->taps[k] / 32768.0 * sin(w * k);
+	}
+	double fir = sqrt(re * re + im * im);
+
+	const BiquadCoeffs *c = &preset->biquad;
+	double wd = w * preset->decimation;
+	double nr = c->b0 + c->b1 * cos(wd) + c->b2 * cos(2 * wd);
+	double ni = -c->b1 * sin(wd) - c->b2 * sin(2 * wd);
+	double dr = 16384 + c->a1 * cos(wd) + c->a2 * cos(2 * wd);
+	double di = -c->a1 * sin(wd) - c->a2 * sin(2 * wd);
+	return fir * sqrt((nr * nr + ni * ni) / (dr * dr + di * di));
+}
+
+
+//
+// Runs a sine at f through the fixed-point stage and returns the output
+// amplitude over the input amplitude, measured after the filter settles.
+//
+static double measured_gain(const FilterPreset *preset, double fs, double f, int16_t *in, int16_t *out)
+{
+	FilterStage stage;
+	unsigned int produced = 0;
+
+	for (int i = 0; i < TEST_SAMPLES; i++)
+	{
+		in[i] = (int16_t)lround(TEST_MID + TEST_AMPLITUDE * sin(2 * pi * f / fs * i));
+	}
+	Filter_Init(&stage, preset, TEST_MID);
+	for (int i = 0; i < TEST_SAMPLES; i += TEST_BLOCK)
+	{
+		produced += Filter_ProcessBlock(&stage, &in[i], &out[produced], TEST_BLOCK);
+	}
+
+	// Skip the first half to let the transient die out, then take the RMS
+	double sum = 0, sumSquares = 0;
+	unsigned int count = produced - produced / 2;
+	for (unsigned int i = produced / 2; i < produced; i++)
+	{
+		sum += out[i];
+		sumSquares += (double)out[i] * out[i];
+	}
+	double mean = sum / count;
+	double rms = sqrt(sumSquares / count - mean * mean);
+	return rms * sqrt(2) / TEST_AMPLITUDE;
+}
+
+
+//
+// Cycles Filter_ProcessBlock() takes for n inputs on the Cortex-M0,
+// from the cost model above.
+//
+static double m0_block_cycles(const FilterPreset *preset, unsigned int n)
+{
+	unsigned int outputs = n / preset->decimation;
+
+	return M0_BLOCK_CALLS + n * M0_FIR_INPUT
+		+ outputs * (M0_FIR_OUTPUT + preset->numTaps * M0_FIR_TAP + M0_BIQUAD_OUTPUT + M0_CLAMP_OUTPUT);
+}
+
+
+static void add_point(double *points, int *count, double f, double nyquist)
+{
+	if (f > 0 && f < nyquist && *count < TEST_MAX_POINTS)
+	{
+		points[(*count)++] = f;
+	}
+}
+
+
+static int compare_points(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+int main(int argc, char *argv[])
+{
+	FilterPreset preset = { 0 };
+
+	if (argc < 7)
+	{
+		fprintf(stderr, "usage: filter_design <name> <fsHz> <decimation> <firTaps> "
+			"<firCutoffHz> <biquadCutoffHz> [Q]\n");
+		return 2;
+	}
+
+	double fs = atof(argv[2]);
+	int decimation = atoi(argv[3]);
+	int numTaps = atoi(argv[4]);
+	double firCutoff = atof(argv[5]);
+	double biquadCutoff = atof(argv[6]);
+	double q = (argc > 7) ? atof(argv[7]) : sqrt(0.5);
+
+	if (fs <= 0 || decimation < 1 || decimation > 255 || numTaps < 1 || numTaps > FILTER_MAX_TAPS)
+	{
+		fprintf(stderr, "need fsHz > 0, 1 <= decimation <= 255, 1 <= firTaps <= %d\n", FILTER_MAX_TAPS);
+		return 2;
+	}
+
+	preset.name = argv[1];
+	preset.numTaps = (uint8_t)numTaps;
+	preset.decimation = (uint8_t)decimation;
+	design_fir(&preset, fs, firCutoff);
+	design_biquad(&preset.biquad, fs / decimation, biquadCutoff, q);
+
+	// Initializer for Filter_Presets[] in filter.c
+	printf("\t{ \"%s\", %d, %d,\n\t\t{", preset.name, preset.numTaps, preset.decimation);
+	for (int k = 0; k < numTaps; k++)
+	{
+		// Short FIRs fit on one line, longer ones get eight taps per line
+		const char *separator = (numTaps > 8 && k % 8 == 0) ? "\n\t\t\t" : " ";
+		printf("%s%s%d", k ? "," : "", separator, preset.taps[k]);
+	}
+	printf(" },\n\t\t{ %d, %d, %d, %d, %d } },\n\n",
+		preset.biquad.b0, preset.biquad.b1, preset.biquad.b2, preset.biquad.a1, preset.biquad.a2);
+
+	// Quantized design against the fixed-point code: a grid up to the
+	// output Nyquist, plus points around the FIR and biquad cutoffs
+	int16_t *in = malloc(TEST_SAMPLES * sizeof(int16_t));
+	int16_t *out = malloc(TEST_SAMPLES * sizeof(int16_t));
+	double nyquist = fs / decimation / 2;
+	static const double around[] = { 0.5, 0.8, 0.9, 1.0, 1.1, 1.25, 2.0 };
+	double points[TEST_MAX_POINTS];
+	int count = 0;
+	int failures = 0;
+
+	// Lowest point still gives 20 periods in the measured half of the test signal
+	add_point(points, &count, fmax(1, 40 * fs / TEST_SAMPLES), nyquist);
+	for (int step = 1; step <= 8; step++)
+	{
+		add_point(points, &count, nyquist * step / 8 * 0.99, nyquist);
+	}
+	for (unsigned int i = 0; i < sizeof(around) / sizeof(around[0]); i++)
+	{
+		if (numTaps > 1)
+		{
+			add_point(points, &count, firCutoff * around[i], nyquist);
+		}
+		add_point(points, &count, biquadCutoff * around[i], nyquist);
+	}
+	qsort(points, count, sizeof(points[0]), compare_points);
+	int unique = 0;
+	for (int i = 0; i < count; i++)
+	{
+		// Cutoffs can land on the same point, e.g. 2 x 200 Hz and 0.5 x 800 Hz
+		if (unique == 0 || points[i] != points[unique - 1])
+		{
+			points[unique++] = points[i];
+		}
+	}
+	count = unique;
+
+	printf("%10s %12s %12s\n", "Hz", "design dB", "measured dB");
+	for (int i = 0; i < count; i++)
+	{
+		// Floor at -120 dB, the fixed-point output rounds to exactly zero before that
+		double design = 20 * log10(fmax(response(&preset, fs, points[i]), 1e-6));
+		double measured = 20 * log10(fmax(measured_gain(&preset, fs, points[i], in, out), 1e-6));
+		int bad = design > CHECK_FLOOR_DB && fabs(design - measured) > CHECK_TOLERANCE_DB;
+		printf("%10.1f %12.2f %12.2f%s\n", points[i], design, measured, bad ? "  FAIL" : "");
+		failures += bad;
+	}
+
+	// Throughput of the block API on this host
+	FilterStage stage;
+	Filter_Init(&stage, &preset, TEST_MID);
+	double begin = now_seconds();
+	for (int i = 0; i < TEST_SAMPLES; i += TEST_BLOCK)
+	{
+		Filter_ProcessBlock(&stage, &in[i], out, TEST_BLOCK);
+	}
+	double elapsed = now_seconds() - begin;
+	printf("\n%.1f ns per input sample on this host, %.2f multiplies per input sample\n",
+		elapsed * 1e9 / TEST_SAMPLES, (numTaps + 5.0) / decimation);
+
+	// The main loop has to filter a block before TIM3 has filled the next one
+	double cycles = m0_block_cycles(&preset, TEST_BLOCK);
+	double budget = M0_CPU_HZ / fs * TEST_BLOCK;
+	printf("Cortex-M0 estimate: %.0f cycles per %d sample block (%.1f per input sample), "
+		"%.1f%% of the %.0f cycle budget at %.0f Hz\n", cycles, TEST_BLOCK, cycles / TEST_BLOCK,
+		100 * cycles / budget, budget, fs);
+	if (cycles > budget)
+	{
+		printf("FAIL: over the cycle budget\n");
+		failures++;
+	}
+	if (failures)
+	{
+		printf("FAIL: %d check%s\n", failures, failures == 1 ? "" : "s");
+	}
+
+	free(in);
+	free(out);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,335 @@
+//
+// Host replay tool for the measurement core.
+//
+// Feeds an edge trace through measure.c, the same code the EXTI handlers
+// run, and prints every published reading followed by a throughput summary.
+// Traces come either from a Capture_Dump() on the trace device (firmware
+// built with CAPTURE_EDGES) or from the built-in synthetic generator.
+//
+// Build on Linux from the repository root:
+//   gcc -O2 -I. -o replay tools/replay.c measure.c settings.c
+//
+// Usage:
+//   replay [-q] [-r passes] <dump.txt>
+//   replay [-q] [-r passes] [-g glitches] -s <edges> <freqHz> [jitterCycles]
+//
+//   -q  only print the summary
+//   -r  replay the trace this many times, for a steadier throughput figure
+//   -g  add this many stray edges per 1000 synthetic edges, at random times
+//
+// With -s, readings more than 1% off freqHz are counted as glitches that
+// got through. Compare glitch rejection settings by rebuilding with e.g.
+// -DMEASURE_MEDIAN_WINDOW=1 or -DMEASURE_MAX_FREQ_HZ=10000.
+//
+// A dump is replayed from the Measure state and with the glitch settings
+// the board had, so the readings match the board edge for edge. A dump
+// taken with other MEASURE_* values is refused; rebuild to match it. Only
+// the first dump in a file is replayed.
+//
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "measure.h"
+#include "capture.h"
+
+typedef struct
+{
+	CaptureRecord *records; // Captured edges, counts as TIM2 saw them
+	uint64_t *times;        // Synthetic edges, absolute times in timer cycles
+	size_t length;
+	uint16_t adc;           // ADC reading for synthetic edges
+	uint32_t nominalHz;     // Frequency of the synthetic signal, 0 for dumps
+	uint32_t outliers;      // Published readings more than 1% off nominalHz
+	Measure start;          // Measure state before the first captured edge
+	int hasStart;           // Set when the dump carried an M line
+} Trace;
+
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static int load_dump(const char *path, Trace *trace, Settings *settings)
+{
+	FILE *file = fopen(path, "r");
+	char line[256];
+	size_t capacity = CAPTURE_DEPTH;
+	uint8_t flags = 0;
+	int dumps = 0;
+	int result = 0;
+
+	if (file == NULL)
+	{
+		perror(path);
+		return -1;
+	}
+
+	trace->records = malloc(capacity * sizeof(CaptureRecord));
+	trace->length = 0;
+	while (result == 0 && fgets(line, sizeof(line), file) != NULL)
+	{
+		unsigned int a, b, c, d, window, maxFreq;
+		int offset, used;
+
+		if (sscanf(line, "S %u %d %u %u %u", &a, &offset, &c, &window, &maxFreq) == 5)
+		{
+			if (++dumps > 1)
+			{
+				fprintf(stderr, "%s: only the first dump is replayed\n", path);
+				break;
+			}
+			if (window != MEASURE_MEDIAN_WINDOW || maxFreq != MEASURE_MAX_FREQ_HZ)
+			{
+				fprintf(stderr, "%s: captured with MEASURE_MEDIAN_WINDOW=%u MEASURE_MAX_FREQ_HZ=%u, "
+					"rebuild replay with the same values\n", path, window, maxFreq);
+				result = -1;
+				break;
+			}
+			settings->timerClockHz = a;
+			settings->adcOffset = (int16_t)offset;
+			settings->resFullScaleOhms = (uint16_t)c;
+		}
+		else if (sscanf(line, "M %u %u %u %u%n", &a, &b, &c, &d, &used) == 4)
+		{
+			const char *cursor = line + used;
+			trace->start.armed = (uint8_t)a;
+			trace->start.filled = (uint8_t)b;
+			trace->start.next = (uint8_t)c;
+			trace->start.minCounts = d;
+			for (int i = 0; i < MEASURE_MEDIAN_WINDOW; i++)
+			{
+				if (sscanf(cursor, " %u%n", &a, &used) != 1)
+				{
+					fprintf(stderr, "%s: short M line\n", path);
+					result = -1;
+					break;
+				}
+				trace->start.window[i] = a;
+				cursor += used;
+			}
+			trace->hasStart = 1;
+		}
+		else if (line[0] == 'R')
+		{
+			flags |= CAPTURE_FLAG_RESET;
+		}
+		else if (sscanf(line, "E %u %u %u", &a, &b, &c) == 3)
+		{
+			if (trace->length == capacity)
+			{
+				capacity *= 2;
+				trace->records = realloc(trace->records, capacity * sizeof(CaptureRecord));
+			}
+			trace->records[trace->length].line = (uint8_t)a;
+			trace->records[trace->length].counts = b;
+			trace->records[trace->length].adc = (uint16_t)c;
+			trace->records[trace->length].flags = flags;
+			trace->length++;
+			flags = 0;
+		}
+	}
+	fclose(file);
+	if (result == 0 && !trace->hasStart)
+	{
+		fprintf(stderr, "%s: no M line, readings before the first arming edge may differ\n", path);
+	}
+	return result;
+}
+
+
+static uint32_t next_random(uint32_t *seed)
+{
+	*seed = *seed * 1664525u + 1013904223u;
+	return *seed >> 8;
+}
+
+
+static void make_synthetic(Trace *trace, size_t edges, uint32_t freqHz, uint32_t jitter,
+	uint32_t glitches, const Settings *settings)
+{
+	uint64_t period = settings->timerClockHz / freqHz;
+	uint64_t t = period; // Leaves room for negative jitter on the first edge
+	uint32_t seed = 1; // Fixed seed, so every run replays the same trace
+	size_t capacity = 2 * edges; // At most one stray edge per real one
+
+	trace->times = malloc(capacity * sizeof(uint64_t));
+	trace->length = 0;
+	trace->adc = SETTINGS_ADC_FULL_SCALE / 2;
+	trace->nominalHz = freqHz;
+	for (size_t i = 0; i < edges; i++)
+	{
+		int64_t offset = jitter ? (int64_t)next_random(&seed) % (2 * (int64_t)jitter + 1) - jitter : 0;
+		trace->times[trace->length++] = t + offset;
+		if (glitches && next_random(&seed) % 1000 < glitches)
+		{
+			// Stray edge somewhere before the next real edge, even with jitter
+			trace->times[trace->length++] = t + offset + 1 + next_random(&seed) % (period - 2 * jitter - 1);
+		}
+		t += period;
+	}
+}
+
+
+//
+// Replays the trace once. Synthetic edges emulate TIM2: the count is the
+// time since the edge that last armed the measurement, as on the board.
+// A dump starts from the captured Measure state; stats carry over.
+//
+static void replay(Trace *trace, Measure *measure, const Settings *settings, int print)
+{
+	uint64_t start = 0;
+
+	if (trace->hasStart)
+	{
+		measure->armed = trace->start.armed;
+		measure->filled = trace->start.filled;
+		measure->next = trace->start.next;
+		measure->minCounts = trace->start.minCounts;
+		memcpy(measure->window, trace->start.window, sizeof(measure->window));
+	}
+
+	for (size_t i = 0; i < trace->length; i++)
+	{
+		uint32_t counts;
+		uint16_t adc;
+		uint8_t line;
+
+		if (trace->records != NULL)
+		{
+			counts = trace->records[i].counts;
+			adc = trace->records[i].adc;
+			line = trace->records[i].line;
+			if (trace->records[i].flags & CAPTURE_FLAG_RESET)
+			{
+				Measure_Reset(measure); // Mode switch, as done by the EXTI handler
+			}
+		}
+		else
+		{
+			counts = (uint32_t)(trace->times[i] - start);
+			adc = trace->adc;
+			line = 1;
+		}
+
+		int result = Measure_Edge(measure, counts, adc, settings);
+		if (result == MEASURE_ARMED)
+		{
+			start = (trace->times != NULL) ? trace->times[i] : 0;
+		}
+		else if (result == MEASURE_PUBLISHED)
+		{
+			uint32_t error = (measure->freq > trace->nominalHz)
+				? measure->freq - trace->nominalHz : trace->nominalHz - measure->freq;
+			if (trace->nominalHz && error > trace->nominalHz / 100)
+			{
+				trace->outliers++;
+			}
+			if (print)
+			{
+				// EXTI2 (function generator) publishes no resistance
+				printf("F %u R %u\n", measure->freq, (line == 1) ? measure->res : 0);
+			}
+		}
+	}
+}
+
+
+static int usage(void)
+{
+	fprintf(stderr,
+		"usage: replay [-q] [-r passes] <dump.txt>\n"
+		"       replay [-q] [-r passes] [-g glitches] -s <edges> <freqHz> [jitterCycles]\n");
+	return 2;
+}
+
+
+int main(int argc, char *argv[])
+{
+	Settings settings;
+	Measure measure;
+	Trace trace;
+	uint32_t glitches = 0;
+	int quiet = 0;
+	long passes = 1;
+	int arg = 1;
+
+	Settings_Defaults(&settings);
+	memset(&trace, 0, sizeof(trace));
+
+	for (; arg < argc && argv[arg][0] == '-'; arg++)
+	{
+		if (strcmp(argv[arg], "-q") == 0)
+		{
+			quiet = 1;
+		}
+		else if (strcmp(argv[arg], "-r") == 0 && arg + 1 < argc)
+		{
+			passes = atol(argv[++arg]);
+		}
+		else if (strcmp(argv[arg], "-g") == 0 && arg + 1 < argc)
+		{
+			glitches = strtoul(argv[++arg], NULL, 0);
+		}
+		else if (strcmp(argv[arg], "-s") == 0 && arg + 2 < argc)
+		{
+			size_t edges = strtoul(argv[arg + 1], NULL, 0);
+			uint32_t freqHz = strtoul(argv[arg + 2], NULL, 0);
+			uint32_t jitter = (arg + 3 < argc) ? strtoul(argv[arg + 3], NULL, 0) : 0;
+			if (edges == 0 || freqHz == 0 || settings.timerClockHz / freqHz <= 2 * jitter + 1)
+			{
+				return usage();
+			}
+			make_synthetic(&trace, edges, freqHz, jitter, glitches, &settings);
+			arg = argc;
+			break;
+		}
+		else
+		{
+			return usage();
+		}
+	}
+
+	if (trace.times == NULL)
+	{
+		if (arg >= argc || load_dump(argv[arg], &trace, &settings) != 0)
+		{
+			return usage();
+		}
+	}
+	if (passes < 1)
+	{
+		passes = 1;
+	}
+
+	Measure_Init(&measure, &settings);
+	double begin = now_seconds();
+	for (long pass = 0; pass < passes; pass++)
+	{
+		replay(&trace, &measure, &settings, !quiet && pass == 0);
+	}
+	double elapsed = now_seconds() - begin;
+
+	double edges = (double)trace.length * passes;
+	printf("edges %.0f readings %u min %u max %u mean %u Hz\n", edges,
+		(unsigned int)measure.stats.count, measure.stats.min, measure.stats.max,
+		Measure_Mean(&measure.stats));
+	printf("rejected %u edges", (unsigned int)measure.stats.rejected);
+	if (trace.nominalHz)
+	{
+		printf(", %u readings more than 1%% off %u Hz", (unsigned int)trace.outliers,
+			(unsigned int)trace.nominalHz);
+	}
+	printf("\n");
+	printf("elapsed %.3f s, %.2f Medges/s\n", elapsed,
+		elapsed > 0 ? edges / elapsed / 1e6 : 0.0);
+
+	free(trace.records);
+	free(trace.times);
+	return 0;
+}
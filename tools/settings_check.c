@@ -0,0 +1,328 @@
+//
+// Host check for the settings store.
+//
+// Runs settings.c against a RAM array standing in for the two flash pages.
+// Like the F0 flash, the stand-in refuses to program a halfword that is not
+// erased, and it can be told to lose power partway through a program. The
+// record layout is encoded here independently of settings.c, so a change
+// to the on-flash format shows up as a failure.
+//
+// Build and run on Linux from the repository root:
+//   gcc -O2 -I. -o settings_check tools/settings_check.c settings.c && ./settings_check
+//
+#include <stdio.h>
+#include <string.h>
+#include "settings.h"
+
+#define PAGE_SIZE 1024
+#define SLOTS_PER_PAGE (PAGE_SIZE / SETTINGS_RECORD_BYTES)
+
+static uint16_t ram[2][PAGE_SIZE / 2];
+static unsigned int eraseCount[2];
+static int tornAfter = -1; // Halfwords left before a simulated power loss, -1 for never
+static int failures = 0;
+
+
+static int ram_page(uintptr_t address)
+{
+	return address >= (uintptr_t)ram[1];
+}
+
+
+static void ram_read(uintptr_t address, void *data, uint32_t bytes)
+{
+	memcpy(data, (const void *)address, bytes);
+}
+
+
+static int ram_erase(uintptr_t page)
+{
+	eraseCount[ram_page(page)]++;
+	memset((void *)page, 0xFF, PAGE_SIZE);
+	return 0;
+}
+
+
+static int ram_program(uintptr_t address, const uint16_t *data, uint32_t halfwords)
+{
+	uint16_t *target = (uint16_t *)address;
+
+	for (uint32_t i = 0; i < halfwords; i++)
+	{
+		if (tornAfter == 0)
+		{
+			return -1; // Power lost, the rest of the record is never written
+		}
+		if (tornAfter > 0)
+		{
+			tornAfter--;
+		}
+		if (target[i] != 0xFFFF)
+		{
+			return -1; // PGERR: the halfword was not erased
+		}
+		target[i] = data[i];
+	}
+	return 0;
+}
+
+
+static SettingsFlash ramFlash =
+{
+	{ 0, 0 },
+	PAGE_SIZE,
+	ram_read,
+	ram_erase,
+	ram_program
+};
+
+
+static void reset_flash(void)
+{
+	memset(ram, 0xFF, sizeof(ram));
+	eraseCount[0] = eraseCount[1] = 0;
+	tornAfter = -1;
+}
+
+
+//
+// CRC-16/CCITT-FALSE, written out separately from settings.c on purpose
+//
+static uint16_t crc16(const uint8_t *data, size_t length)
+{
+	uint16_t crc = 0xFFFF;
+
+	for (size_t i = 0; i < length; i++)
+	{
+		crc ^= (uint16_t)(data[i] << 8);
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+		}
+	}
+	return crc;
+}
+
+
+//
+// Writes a record straight into the RAM flash, in the documented layout:
+// version, sequence, timerClockHz, adcOffset, resFullScaleOhms, mode,
+// reserved, crc, little endian.
+//
+static void put_record(int page, int slot, uint16_t version, uint16_t sequence, uint32_t timerClockHz)
+{
+	uint8_t bytes[SETTINGS_RECORD_BYTES];
+
+	bytes[0] = version & 0xFF;
+	bytes[1] = version >> 8;
+	bytes[2] = sequence & 0xFF;
+	bytes[3] = sequence >> 8;
+	for (int i = 0; i < 4; i++)
+	{
+		bytes[4 + i] = (timerClockHz >> (8 * i)) & 0xFF;
+	}
+	bytes[8] = bytes[9] = 0;                  // adcOffset
+	bytes[10] = SETTINGS_DEFAULT_RES_FULL_SCALE & 0xFF;
+	bytes[11] = SETTINGS_DEFAULT_RES_FULL_SCALE >> 8;
+	bytes[12] = 1;                            // mode
+	bytes[13] = 0xFF;                         // reserved
+	uint16_t crc = crc16(bytes, 14);
+	bytes[14] = crc & 0xFF;
+	bytes[15] = crc >> 8;
+	memcpy((uint8_t *)ram[page] + slot * SETTINGS_RECORD_BYTES, bytes, sizeof(bytes));
+}
+
+
+static uint16_t slot_halfword(int page, int slot, int index)
+{
+	return ram[page][slot * SETTINGS_RECORD_BYTES / 2 + index];
+}
+
+
+static void check(int condition, const char *test, const char *what)
+{
+	if (!condition)
+	{
+		printf("FAIL %s: %s\n", test, what);
+		failures++;
+	}
+}
+
+
+static void save_clock(SettingsStore *store, uint32_t timerClockHz)
+{
+	Settings settings;
+
+	Settings_Defaults(&settings);
+	settings.timerClockHz = timerClockHz;
+	Settings_Save(store, &settings);
+}
+
+
+static uint32_t load_clock(int *result)
+{
+	SettingsStore store;
+	Settings settings;
+
+	Settings_Init(&store, &ramFlash);
+	*result = Settings_Load(&store, &settings);
+	return settings.timerClockHz;
+}
+
+
+static void test_empty(void)
+{
+	SettingsStore store;
+	Settings settings;
+
+	reset_flash();
+	Settings_Init(&store, &ramFlash);
+	check(Settings_Load(&store, &settings) == -1, "empty", "load should report no record");
+	check(settings.timerClockHz == SETTINGS_DEFAULT_TIMER_CLOCK_HZ
+		&& settings.adcOffset == SETTINGS_DEFAULT_ADC_OFFSET
+		&& settings.resFullScaleOhms == SETTINGS_DEFAULT_RES_FULL_SCALE
+		&& settings.mode == SETTINGS_DEFAULT_MODE, "empty", "defaults expected");
+}
+
+
+static void test_round_trip(void)
+{
+	SettingsStore store;
+	Settings saved, loaded;
+	int result;
+
+	reset_flash();
+	Settings_Init(&store, &ramFlash);
+	saved.timerClockHz = 47998123;
+	saved.adcOffset = -7;
+	saved.resFullScaleOhms = 4987;
+	saved.mode = 0;
+	check(Settings_Save(&store, &saved) == 0, "round trip", "save failed");
+	Settings_Init(&store, &ramFlash);
+	result = Settings_Load(&store, &loaded);
+	check(result == 0 && loaded.timerClockHz == saved.timerClockHz && loaded.adcOffset == saved.adcOffset
+		&& loaded.resFullScaleOhms == saved.resFullScaleOhms && loaded.mode == saved.mode,
+		"round trip", "loaded record differs from saved one");
+	check(slot_halfword(0, 0, 0) == SETTINGS_VERSION && slot_halfword(0, 0, 1) == 1,
+		"round trip", "first record should be version 1, sequence 1 in page 0 slot 0");
+	check(crc16((const uint8_t *)ram[0], 14) == slot_halfword(0, 0, 7), "round trip", "CRC mismatch");
+}
+
+
+static void test_page_swap(void)
+{
+	SettingsStore store;
+	int result;
+
+	reset_flash();
+	Settings_Init(&store, &ramFlash);
+	for (uint32_t i = 1; i <= SLOTS_PER_PAGE; i++)
+	{
+		save_clock(&store, i);
+	}
+	check(eraseCount[0] == 1 && eraseCount[1] == 0, "page swap", "64 saves should erase page 0 once");
+	save_clock(&store, SLOTS_PER_PAGE + 1);
+	check(eraseCount[0] == 1 && eraseCount[1] == 1, "page swap", "65th save should erase page 1");
+	check(slot_halfword(1, 0, 1) == SLOTS_PER_PAGE + 1, "page swap", "65th record should start page 1");
+	check(load_clock(&result) == SLOTS_PER_PAGE + 1 && result == 0, "page swap", "65th record should win");
+
+	// A fresh store appends after the newest record, in the other page
+	Settings_Init(&store, &ramFlash);
+	save_clock(&store, 1000);
+	check(slot_halfword(1, 1, 1) == SLOTS_PER_PAGE + 2, "page swap", "66th record should go to page 1 slot 1");
+	check(eraseCount[1] == 1, "page swap", "66th save should not erase");
+}
+
+
+static void test_newest_across_pages(void)
+{
+	int result;
+
+	reset_flash();
+	put_record(0, 0, SETTINGS_VERSION, 100, 1111);
+	put_record(1, 0, SETTINGS_VERSION, 99, 2222);
+	check(load_clock(&result) == 1111, "newest", "page 0 holds the newest record");
+
+	reset_flash();
+	put_record(0, 0, SETTINGS_VERSION, 5, 1111);
+	put_record(0, 1, SETTINGS_VERSION, 6, 1112);
+	put_record(1, 0, SETTINGS_VERSION, 7, 2222);
+	check(load_clock(&result) == 2222, "newest", "page 1 holds the newest record");
+}
+
+
+static void test_torn_write(void)
+{
+	SettingsStore store;
+	int result;
+
+	reset_flash();
+	Settings_Init(&store, &ramFlash);
+	save_clock(&store, 1111);
+	tornAfter = 1; // Only the version halfword of the next record lands
+	save_clock(&store, 2222);
+	tornAfter = -1;
+	check(slot_halfword(0, 1, 0) == SETTINGS_VERSION && slot_halfword(0, 1, 7) == 0xFFFF,
+		"torn write", "slot 1 should hold only a version halfword");
+	check(load_clock(&result) == 1111 && result == 0, "torn write", "torn record should be skipped");
+
+	Settings_Init(&store, &ramFlash);
+	save_clock(&store, 3333);
+	check(slot_halfword(0, 2, 1) == 2, "torn write", "next save should skip the torn slot");
+	check(load_clock(&result) == 3333, "torn write", "record after the torn slot should win");
+}
+
+
+static void test_wrong_version(void)
+{
+	int result;
+
+	reset_flash();
+	put_record(0, 0, SETTINGS_VERSION, 1, 1111);
+	put_record(0, 1, SETTINGS_VERSION + 1, 2, 2222); // Valid CRC, newer, but another format
+	check(load_clock(&result) == 1111, "wrong version", "record with another version should be ignored");
+
+	reset_flash();
+	put_record(0, 0, SETTINGS_VERSION + 1, 1, 2222);
+	check(load_clock(&result) == SETTINGS_DEFAULT_TIMER_CLOCK_HZ && result == -1,
+		"wrong version", "only a foreign record should give the defaults");
+}
+
+
+static void test_sequence_wrap(void)
+{
+	SettingsStore store;
+	int result;
+
+	reset_flash();
+	put_record(0, 0, SETTINGS_VERSION, 0xFFFE, 1111);
+	Settings_Init(&store, &ramFlash);
+	save_clock(&store, 2222);
+	save_clock(&store, 3333);
+	check(slot_halfword(0, 1, 1) == 0xFFFF && slot_halfword(0, 2, 1) == 0x0000,
+		"sequence wrap", "sequence should go 0xFFFE, 0xFFFF, 0x0000");
+	check(load_clock(&result) == 3333, "sequence wrap", "sequence 0 after 0xFFFF should win");
+
+	reset_flash();
+	put_record(0, 0, SETTINGS_VERSION, 0xFFFF, 1111);
+	put_record(1, 0, SETTINGS_VERSION, 0x0001, 2222);
+	check(load_clock(&result) == 2222, "sequence wrap", "sequence 1 should beat 0xFFFF");
+}
+
+
+int main(void)
+{
+	ramFlash.pages[0] = (uintptr_t)ram[0];
+	ramFlash.pages[1] = (uintptr_t)ram[1];
+
+	test_empty();
+	test_round_trip();
+	test_page_swap();
+	test_newest_across_pages();
+	test_torn_write();
+	test_wrong_version();
+	test_sequence_wrap();
+
+	printf("%s: %d failure%s\n", failures ? "FAIL" : "PASS", failures, failures == 1 ? "" : "s");
+	return failures ? 1 : 0;
+}
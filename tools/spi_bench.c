@@ -0,0 +1,334 @@
+//
+// Host benchmark for the LED Display SPI transport.
+//
+// Runs a refresh_OLED() worth of bytes (two lines of 3 command and 96 or
+// 80 glyph bytes) through a fake SPI1 that counts CPU cycles at 48 MHz:
+//   - a 4 byte TX FIFO that drains into the shifter, one frame per
+//     8 SCK periods (8 x prescaler CPU cycles), back to back;
+//   - SR.TXE while the FIFO holds at most 2 bytes, SR.FTLVL from the FIFO
+//     level and SR.BSY while a frame is shifting or queued;
+//   - a fixed CPU cost per register or pin access.
+// The new path is oled.c itself. The old per-byte HAL path is rebuilt
+// below from the code it replaced. The fake also logs what the display
+// would latch and fails the run if any byte is lost, cut off by CS# or
+// sent with the wrong D/C#.
+//
+// Build and run on Linux from the repository root:
+//   gcc -O2 -I. -include tools/spi_fake.h -o spi_bench tools/spi_bench.c oled.c && ./spi_bench
+//
+// Usage:
+//   spi_bench [-n refreshes] [-h halCycles]
+//
+//   -h  CPU cycles HAL_SPI_Transmit() spends per byte outside the waits
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "oled.h"
+
+#define CPU_HZ 48000000.0
+
+/* Assumed Cortex-M0 costs, in CPU cycles, at one flash wait state */
+#define CYCLES_SR_POLL 6   // ldr SR, tst, branch back
+#define CYCLES_DR_WRITE 12 // Pack the bytes, str to DR, advance the loop
+#define CYCLES_PIN 6       // Read-modify-write of GPIOB->ODR
+#define HAL_TRANSMIT_CYCLES 200 // Default for -h: lock, checks, state and tick reads
+
+#define FIFO_BYTES 4
+#define LOG_BYTES 4096
+
+typedef struct
+{
+	uint64_t now;          // CPU cycles since the run started
+	uint32_t prescaler;    // SCK = CPU_HZ / prescaler
+	uint8_t fifo[FIFO_BYTES];
+	unsigned int level;    // Bytes in the TX FIFO
+	int shifting;          // A frame is in the shift register
+	uint8_t shiftByte;
+	uint64_t shiftEnd;     // Cycle at which that frame has left
+	int cs, dc;            // Pin levels
+	uint8_t log[LOG_BYTES];   // Bytes the display latched
+	uint8_t logDc[LOG_BYTES]; // D/C# level each one was latched with
+	unsigned int logLength;
+	unsigned int errors;   // Lost or corrupted frames
+} FakeSpi;
+
+static FakeSpi spi;
+
+
+//
+// Moves the fake forward to spi.now: finishes the frames whose last SCK
+// edge has passed and starts the next ones from the FIFO, back to back.
+//
+static void fake_run(void)
+{
+	while (spi.shifting && spi.shiftEnd <= spi.now)
+	{
+		// The SSD1306 latches a byte, and D/C#, on its 8th SCK edge
+		if (spi.cs == 0 && spi.logLength < LOG_BYTES)
+		{
+			spi.log[spi.logLength] = spi.shiftByte;
+			spi.logDc[spi.logLength] = (uint8_t)spi.dc;
+			spi.logLength++;
+		}
+		else
+		{
+			spi.errors++;
+		}
+		spi.shifting = 0;
+		if (spi.level)
+		{
+			spi.shiftByte = spi.fifo[0];
+			memmove(spi.fifo, spi.fifo + 1, --spi.level);
+			spi.shifting = 1;
+			spi.shiftEnd += 8 * spi.prescaler;
+		}
+	}
+}
+
+
+static void fake_reset(uint32_t prescaler)
+{
+	memset(&spi, 0, sizeof(spi));
+	spi.prescaler = prescaler;
+	spi.cs = 1;
+}
+
+
+static void fake_spend(unsigned int cycles)
+{
+	spi.now += cycles;
+	fake_run();
+}
+
+
+uint16_t Fake_SPI_SR(void)
+{
+	uint16_t sr = 0;
+
+	fake_spend(CYCLES_SR_POLL);
+	if (spi.level <= FIFO_BYTES / 2)
+	{
+		sr |= SPI_SR_TXE;
+	}
+	sr |= (uint16_t)(((spi.level == 0) ? 0 : (spi.level == 1) ? 1 : (spi.level == 2) ? 2 : 3) << 11);
+	if (spi.shifting || spi.level)
+	{
+		sr |= SPI_SR_BSY;
+	}
+	return sr;
+}
+
+
+void Fake_SPI_Write(uint16_t value, unsigned int bytes)
+{
+	fake_spend(CYCLES_DR_WRITE);
+	for (unsigned int i = 0; i < bytes; i++)
+	{
+		uint8_t byte = (uint8_t)(value >> (8 * i)); // Low byte goes first
+		if (!spi.shifting)
+		{
+			spi.shiftByte = byte;
+			spi.shifting = 1;
+			spi.shiftEnd = spi.now + 8 * spi.prescaler;
+		}
+		else if (spi.level < FIFO_BYTES)
+		{
+			spi.fifo[spi.level++] = byte;
+		}
+		else
+		{
+			spi.errors++; // Written while the FIFO was full, the byte is lost
+		}
+	}
+}
+
+
+void Fake_Pin(int cs, int level)
+{
+	fake_spend(CYCLES_PIN);
+	if (cs)
+	{
+		if (level && (spi.shifting || spi.level))
+		{
+			spi.errors++; // CS# raised with frames still going out
+		}
+		spi.cs = level;
+	}
+	else
+	{
+		if (spi.shifting)
+		{
+			spi.errors++; // D/C# changed under a frame
+		}
+		spi.dc = level;
+	}
+}
+
+
+//
+// The per-byte path this replaced: oled_Write_Cmd()/oled_Write_Data()
+// framed every byte with CS# and D/C#, and oled_Write() waited for TXE,
+// called HAL_SPI_Transmit() (which waits for FTLVL and BSY itself) and
+// then waited for BSY again.
+//
+static unsigned int halCycles = HAL_TRANSMIT_CYCLES;
+
+static void legacy_write(int dc, unsigned char value)
+{
+	Fake_Pin(1, 1);
+	Fake_Pin(0, dc);
+	Fake_Pin(1, 0);
+	while (!(Fake_SPI_SR() & SPI_SR_TXE));
+	fake_spend(halCycles);
+	Fake_SPI_Write(value, 1);
+	while (Fake_SPI_SR() & SPI_SR_FTLVL);
+	while (Fake_SPI_SR() & SPI_SR_BSY);
+	while (Fake_SPI_SR() & SPI_SR_BSY);
+	Fake_Pin(1, 1);
+}
+
+
+static void legacy_span(int dc, const unsigned char *bytes, unsigned int length)
+{
+	for (unsigned int i = 0; i < length; i++)
+	{
+		legacy_write(dc, bytes[i]);
+	}
+}
+
+
+static void span_span(int dc, const unsigned char *bytes, unsigned int length)
+{
+	if (dc)
+	{
+		oled_Write_Data_Span(bytes, length);
+	}
+	else
+	{
+		oled_Write_Cmd_Span(bytes, length);
+	}
+}
+
+
+/* One refresh_OLED(): "R: %5u Ohms" and "F: %5u Hz", 8 glyph bytes per character */
+static unsigned char cmds[2][3] = { { 0xB0, 0x02, 0x10 }, { 0xB1, 0x02, 0x10 } };
+static unsigned char glyphs[2][16 * 8];
+static const unsigned int glyphBytes[2] = { 12 * 8, 10 * 8 };
+
+#define REFRESH_BYTES (2 * 3 + 12 * 8 + 10 * 8)
+
+
+static void refresh(void (*send)(int, const unsigned char *, unsigned int))
+{
+	for (int line = 0; line < 2; line++)
+	{
+		send(0, cmds[line], sizeof(cmds[line]));
+		send(1, glyphs[line], glyphBytes[line]);
+	}
+}
+
+
+//
+// Checks the display got one refresh, byte for byte with the right D/C#
+//
+static int check_log(void)
+{
+	unsigned int n = 0;
+
+	for (int line = 0; line < 2; line++)
+	{
+		for (unsigned int i = 0; i < sizeof(cmds[line]); i++, n++)
+		{
+			if (n >= spi.logLength || spi.log[n] != cmds[line][i] || spi.logDc[n] != 0)
+			{
+				return -1;
+			}
+		}
+		for (unsigned int i = 0; i < glyphBytes[line]; i++, n++)
+		{
+			if (n >= spi.logLength || spi.log[n] != glyphs[line][i] || spi.logDc[n] != 1)
+			{
+				return -1;
+			}
+		}
+	}
+	return (n == spi.logLength && spi.errors == 0) ? 0 : -1;
+}
+
+
+static int run(const char *name, uint32_t prescaler,
+	void (*send)(int, const unsigned char *, unsigned int), long refreshes)
+{
+	uint64_t cycles = 0;
+
+	for (long i = 0; i < refreshes; i++)
+	{
+		fake_reset(prescaler);
+		refresh(send);
+		if (check_log() != 0)
+		{
+			printf("%-9s SCK /%-3u  FAIL: display got %u of %u bytes, %u errors\n", name,
+				(unsigned int)prescaler, spi.logLength, REFRESH_BYTES, spi.errors);
+			return -1;
+		}
+		cycles += spi.now;
+	}
+
+	double seconds = cycles / CPU_HZ / refreshes;
+	printf("%-9s SCK /%-3u %8.1f kHz %9.3f ms %10.0f bytes/s %9.1f refreshes/s  %5.1f%% of wire rate\n",
+		name, (unsigned int)prescaler, CPU_HZ / prescaler / 1e3, seconds * 1e3,
+		REFRESH_BYTES / seconds, 1 / seconds,
+		100.0 * REFRESH_BYTES * 8 * prescaler / CPU_HZ / seconds);
+	return 0;
+}
+
+
+static int usage(void)
+{
+	fprintf(stderr, "usage: spi_bench [-n refreshes] [-h halCycles]\n");
+	return 2;
+}
+
+
+int main(int argc, char *argv[])
+{
+	long refreshes = 1000;
+	int failed = 0;
+
+	for (int arg = 1; arg < argc; arg++)
+	{
+		if (strcmp(argv[arg], "-n") == 0 && arg + 1 < argc)
+		{
+			refreshes = atol(argv[++arg]);
+		}
+		else if (strcmp(argv[arg], "-h") == 0 && arg + 1 < argc)
+		{
+			halCycles = strtoul(argv[++arg], NULL, 0);
+		}
+		else
+		{
+			return usage();
+		}
+	}
+	if (refreshes < 1)
+	{
+		return usage();
+	}
+
+	for (int line = 0; line < 2; line++)
+	{
+		for (unsigned int i = 0; i < sizeof(glyphs[line]); i++)
+		{
+			glyphs[line][i] = (unsigned char)(line * 131 + i * 7);
+		}
+	}
+
+	printf("%u bytes per refresh, %d cycle HAL_SPI_Transmit overhead, %ld refreshes\n",
+		REFRESH_BYTES, (int)halCycles, refreshes);
+	failed |= run("per-byte", 256, legacy_span, refreshes);
+	failed |= run("per-byte", 8, legacy_span, refreshes);
+	failed |= run("span", 256, span_span, refreshes);
+	failed |= run("span", 8, span_span, refreshes);
+	return failed ? 1 : 0;
+}
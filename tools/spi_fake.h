@@ -0,0 +1,29 @@
+//
+// Fake SPI1 and CS#/D/C# pins for tools/spi_bench.c.
+//
+// Force-included into oled.c on the host, so its OLED_* access macros
+// reach the fake instead of the STM32 registers. The SR bits have their
+// STM32F0 values.
+//
+#ifndef SPI_FAKE_H_
+#define SPI_FAKE_H_
+
+#include <stdint.h>
+
+#define SPI_SR_TXE ((uint16_t)0x0002)   // TX FIFO at most half full
+#define SPI_SR_BSY ((uint16_t)0x0080)   // A frame is being shifted out
+#define SPI_SR_FTLVL ((uint16_t)0x1800) // TX FIFO level: 0 empty .. 3 full
+
+uint16_t Fake_SPI_SR(void);
+void Fake_SPI_Write(uint16_t value, unsigned int bytes);
+void Fake_Pin(int cs, int level);
+
+#define OLED_SPI_SR() Fake_SPI_SR()
+#define OLED_SPI_WRITE16(value) Fake_SPI_Write((value), 2)
+#define OLED_SPI_WRITE8(value) Fake_SPI_Write((value), 1)
+#define OLED_CS_HIGH() Fake_Pin(1, 1)
+#define OLED_CS_LOW() Fake_Pin(1, 0)
+#define OLED_DC_CMD() Fake_Pin(0, 0)
+#define OLED_DC_DATA() Fake_Pin(0, 1)
+
+#endif // SPI_FAKE_H_